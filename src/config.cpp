@@ -6,51 +6,32 @@
 #include "config.h"
 
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
 
 namespace config {
-	int getInt(std::string name) {
-		// file handle
-		std::ifstream file("config.txt");
+	// guards the overrides and the config.txt file, which renderers
+	// created on several threads read at once
+	static std::mutex lock;
 
-		// create file in case it doesn't exist
-		if (!file.good()) {
-			std::cout << "[-] Couldn't find 'config.txt' file.\n";
-			file.close();
-			reset();
-			return getInt(name);
-		}
+	// variables overridden at runtime
+	static std::map<std::string, double> overrides;
 
-		for (std::string line; std::getline(file, line); ) {
-			if (line[0] == '#') continue;
-			size_t found = line.find(name);
-			if (found != std::string::npos) {
-				try {
-					// check to see if there's any non-numeric character
-					for (auto& c : line.substr(found + name.size())) {
-						if ((c < '0' || c > '9') && c != ' ') {
-							throw 1;
-						}
-					}
-					// get int from line substring
-					return std::stoi(line.substr(found + name.size()));
-				} catch (...) {
-					std::cout << "[-] Invalid value for variable '" << name << "' in config.txt file.\n";
-					file.close();
-					reset();
-					return getInt(name);
-				}
-			}
-		}
+	void set(std::string name, double value) {
+		std::lock_guard<std::mutex> guard(lock);
+		overrides[name] = value;
+	}
 
-		std::cout << "[-] Variable '" << name << "' was not found in 'config.txt' file.\n";
-		file.close();
-		reset();
-		return getInt(name);
+	static std::ostream* messages = &std::cout;
+
+	void messagesTo(std::ostream& out) {
+		std::lock_guard<std::mutex> guard(lock);
+		messages = &out;
 	}
 
-	void reset() {
-		std::cout << "[+] Resetting config.txt file to standard values.\n";
-		std::ofstream file("config.txt");
+	// the standard config.txt file
+	static void writeDefaults(std::ostream& file) {
 		file << "#======== o u t p u t    f i l e ========#\n";
 		file << "\n";
 		file << "# resolution in pixels #\n";
@@ -61,12 +42,60 @@ namespace config {
 		file << "# set to zero to get a ppm file #\n";
 		file << "png 1\n";
 		file << "\n";
+		file << "# set to one to also get a linear pfm file #\n";
+		file << "# set to two to also get a linear raw float32 file #\n";
+		file << "# run idyll with a pfm file as argument to re-grade it #\n";
+		file << "hdr 0\n";
+		file << "\n";
+		file << "# exposure adjustment in stops #\n";
+		file << "exposure 0.0\n";
+		file << "\n";
+		file << "# gamma correction exponent #\n";
+		file << "gamma 0.45\n";
+		file << "\n";
+		file << "# set to one to store 1/8, 1/4 and 1/2 resolution #\n";
+		file << "# previews before rendering the full image #\n";
+		file << "# set to two to store only the previews #\n";
+		file << "preview 0\n";
+		file << "\n";
+		file << "# set to zero to show a progress bar #\n";
+		file << "# set to one to write progress as json lines #\n";
+		file << "# to the standard error stream #\n";
+		file << "progress 0\n";
+		file << "\n";
 		file << "#======== r e n d e r i n g ========#\n";
 		file << "\n";
 		file << "# number of samples #\n";
 		file << "# more samples equals less noise #\n";
 		file << "samples 4\n";
 		file << "\n";
+		file << "# set to one to clamp every sample to the 0 to 1 #\n";
+		file << "# range before averaging, which keeps single bright #\n";
+		file << "# samples from standing out. set to zero to keep #\n";
+		file << "# the unclamped light at the linear pfm or raw file #\n";
+		file << "clamp 1\n";
+		file << "\n";
+		file << "# sample sequence #\n";
+		file << "# 0: independent random numbers #\n";
+		file << "# 1: scrambled sobol sequence, with samples spread #\n";
+		file << "# over the pixel. less noise and smooth edges #\n";
+		file << "sampler 1\n";
+		file << "\n";
+		file << "# shading mode #\n";
+		file << "# 0: path tracing #\n";
+		file << "# 1: path tracing where every bounce ray also #\n";
+		file << "# estimates the sky light. faster, darker crevices #\n";
+		file << "# 2: ambient occlusion and a single sun shadow ray. #\n";
+		file << "# no bounces, for quick previews #\n";
+		file << "shading 0\n";
+		file << "\n";
+		file << "# time budget in seconds. renders passes of one #\n";
+		file << "# sample per pixel, up to 'samples' of them, and #\n";
+		file << "# stores the best image when time runs out. the #\n";
+		file << "# camera search counts too, and there's no preview #\n";
+		file << "# set to zero for no limit #\n";
+		file << "deadline 0\n";
+		file << "\n";
 		file << "# camera field of view in degrees #\n";
 		file << "fov 45\n";
 		file << "\n";
@@ -74,11 +103,201 @@ namespace config {
 		file << "# this value increases quality and computation time #\n";
 		file << "bounces 2\n";
 		file << "\n";
+		file << "# bounces always traced before paths carrying #\n";
+		file << "# little color start being terminated at random #\n";
+		file << "# set to zero to trace every bounce #\n";
+		file << "roulette 2\n";
+		file << "\n";
+		file << "# set to one to skip the empty space around the #\n";
+		file << "# fractal. doesn't change the image #\n";
+		file << "bounds 1\n";
+		file << "\n";
+		file << "# set to one to match surface detail to the size #\n";
+		file << "# of a pixel. faster, slightly softer far away #\n";
+		file << "lod 0\n";
+		file << "\n";
+		file << "# maximum steps per marched ray #\n";
+		file << "# bounds the cost of rays grazing the fractal #\n";
+		file << "# set to zero for no limit #\n";
+		file << "budget 0\n";
+		file << "\n";
+		file << "# set above zero to measure the sky light seen #\n";
+		file << "# from the surface at sparse points and interpolate #\n";
+		file << "# it everywhere else, with shading 0. crevices get #\n";
+		file << "# darker than with the sky ray of every bounce, #\n";
+		file << "# and rendering isn't faster. it's the largest #\n";
+		file << "# error allowed, smaller values are more accurate #\n";
+		file << "irradiance 0\n";
+		file << "\n";
+		file << "# set to one to keep the linear image of every #\n";
+		file << "# render at the 'cache' directory. rendering the #\n";
+		file << "# same seed with the same settings reads it back #\n";
+		file << "# along with its auxiliary outputs #\n";
+		file << "cache 0\n";
+		file << "\n";
+		file << "# set to one to keep the paths of every render at #\n";
+		file << "# the 'cache' directory. rendering the same seed #\n";
+		file << "# with other colors shades them again instead of #\n";
+		file << "# tracing them. takes 24 bytes per sample and bounce #\n";
+		file << "# and renders needing over 2 GB don't keep them #\n";
+		file << "geometry 0\n";
+		file << "\n";
+		file << "# set to one to also get an image and a histogram #\n";
+		file << "# of the distance estimations done per pixel #\n";
+		file << "stepmap 0\n";
+		file << "\n";
+		file << "# set to one to also store the depth, normal, #\n";
+		file << "# surface color, march steps and hit mask of the #\n";
+		file << "# camera rays as pfm files next to the render #\n";
+		file << "aov 0\n";
+		file << "\n";
 		file << "#======== c p u ========#\n";
 		file << "\n";
 		file << "# idyll is multithreaded by default #\n";
 		file << "# you can adjust the number of threads here #\n";
 		file << "threads 8\n";
 		file << "\n";
+		file << "# set to one to pin every thread to its own core #\n";
+		file << "# physical cores are used before hyperthreads #\n";
+		file << "# run idyll with '--scaling' to measure how well #\n";
+		file << "# rendering scales from one thread to 'threads' #\n";
+		file << "pin 0\n";
+		file << "\n";
+		file << "# set to one to store a timeline of every render #\n";
+		file << "# phase and thread at 'trace.json'. open it at #\n";
+		file << "# ui.perfetto.dev or chrome://tracing #\n";
+		file << "trace 0\n";
+		file << "\n";
+		file << "# set to one to print cpu cycles, instructions, #\n";
+		file << "# branch misses and cache misses of the camera #\n";
+		file << "# search, rendering and encoding. linux only #\n";
+		file << "counters 0\n";
+		file << "\n";
+		file << "#======== e x p l o r a t i o n ========#\n";
+		file << "\n";
+		file << "# run idyll with '--explore' to render random seeds #\n";
+		file << "# as small thumbnails, score them by coverage, #\n";
+		file << "# contrast and edges, and fully render the best #\n";
+		file << "\n";
+		file << "# number of seeds rendered as thumbnails #\n";
+		file << "explore 32\n";
+		file << "\n";
+		file << "# number of best seeds fully rendered #\n";
+		file << "keep 4\n";
+		file << "\n";
+		file << "#======== r e g r e s s i o n ========#\n";
+		file << "\n";
+		file << "# run idyll with '--regress' to render a fixed set #\n";
+		file << "# of seeds and compare them against the references #\n";
+		file << "# stored by the first run or by '--regress-update' #\n";
+		file << "\n";
+		file << "# largest perceptual error allowed per image #\n";
+		file << "tolerance 0.01\n";
+		file << "\n";
+		file << "# largest render time allowed, relative to the #\n";
+		file << "# stored baseline #\n";
+		file << "slowdown 1.25\n";
+		file << "\n";
+	}
+
+	// overwrite the config.txt file with the standard one
+	static void writeFile() {
+		*messages << "[+] Resetting config.txt file to standard values.\n";
+		std::ofstream file("config.txt");
+		writeDefaults(file);
+	}
+
+	//
+	// default value of a variable missing from the config.txt file.
+	// the variable is appended to the file with its comment, so
+	// that every other value the file holds is kept. empty if the
+	// variable doesn't exist
+	//
+	static std::string addDefault(std::string name) {
+		std::ostringstream defaults;
+		writeDefaults(defaults);
+		std::istringstream in(defaults.str());
+		std::string comment;
+		for (std::string line; std::getline(in, line); ) {
+			if (line.empty()) {
+				comment.clear();
+			} else if (line[0] == '#') {
+				comment += line + '\n';
+			} else if (line.compare(0, name.size() + 1, name + ' ') == 0) {
+				std::ofstream file("config.txt", std::ios::app);
+				file << '\n' << comment << line << '\n';
+				*messages << "[+] Added variable '" << name << "' to 'config.txt' file with its standard value.\n";
+				return line.substr(name.size() + 1);
+			}
+		}
+		return "";
+	}
+
+	//
+	// text following a variable's name at the config.txt file,
+	// which is created if it doesn't exist. 'allowed' are the
+	// characters a value can hold besides digits and spaces.
+	// returns the variable's default value if it's missing or
+	// invalid
+	//
+	static std::string lookup(std::string name, std::string allowed) {
+		std::ifstream file("config.txt");
+
+		// create file in case it doesn't exist
+		if (!file.good()) {
+			*messages << "[-] Couldn't find 'config.txt' file.\n";
+			file.close();
+			writeFile();
+			file.open("config.txt");
+		}
+
+		for (std::string line; std::getline(file, line); ) {
+			if (line[0] == '#') continue;
+			size_t found = line.find(name);
+			if (found != std::string::npos) {
+				std::string value = line.substr(found + name.size());
+				// check to see if there's any non-numeric character
+				bool valid = value.find_first_not_of(" 0123456789" + allowed) == std::string::npos && value.find_first_of("0123456789") != std::string::npos;
+				if (valid) {
+					return value;
+				}
+				*messages << "[-] Invalid value for variable '" << name << "' in config.txt file. Using its standard value.\n";
+				std::ostringstream defaults;
+				writeDefaults(defaults);
+				std::istringstream in(defaults.str());
+				for (std::string standard; std::getline(in, standard); ) {
+					if (standard.compare(0, name.size() + 1, name + ' ') == 0) {
+						return standard.substr(name.size() + 1);
+					}
+				}
+				return "0";
+			}
+		}
+
+		file.close();
+		std::string value = addDefault(name);
+		return value.empty() ? "0" : value;
+	}
+
+	int getInt(std::string name) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (overrides.count(name)) {
+			return (int)overrides[name];
+		}
+		return std::stoi(lookup(name, ""));
+	}
+
+	double getDouble(std::string name) {
+		std::lock_guard<std::mutex> guard(lock);
+		if (overrides.count(name)) {
+			return overrides[name];
+		}
+		// same as integers, but allowing signs and decimals
+		return std::stod(lookup(name, ".-"));
+	}
+
+	void reset() {
+		std::lock_guard<std::mutex> guard(lock);
+		writeFile();
 	}
 }
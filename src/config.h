@@ -10,5 +10,17 @@
 
 namespace config {
 	extern int getInt(std::string name);
+	extern double getDouble(std::string name);
 	extern void reset();
+
+	// override a variable for the rest of the run without
+	// touching the config.txt file. used by modes that need fixed
+	// rendering settings. like reading variables, it can be done
+	// from any thread
+	extern void set(std::string name, double value);
+
+	// stream the config's messages are printed to, the standard
+	// output by default. modes that use the standard output for
+	// something else send them elsewhere
+	extern void messagesTo(std::ostream& out);
 }
@@ -0,0 +1,216 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#include "counters.h"
+#include "fractal.h"
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace counters {
+	bool enabled = false;
+
+	// counted events. the task clock is a software event, so it's
+	// usually there even when hardware counters aren't
+	enum event {
+		TASK_CLOCK,
+		CYCLES,
+		INSTRUCTIONS,
+		BRANCH_MISSES,
+		L1D_MISSES,
+		LLC_MISSES,
+		EVENTS
+	};
+
+	// distance estimations are stored after the events
+	const int EVALUATIONS = EVENTS;
+
+	static const char* phaseNames[] = { "camera search", "render", "encode" };
+
+	static std::mutex totalsMutex;
+	static long long totals[PHASES][EVENTS + 1];
+	static bool available[EVENTS];
+
+	// counters of a single thread, opened the first time it enters
+	// a scope and closed when it ends. -1 for unavailable ones
+	struct threadCounters {
+		int fds[EVENTS];
+		threadCounters();
+		~threadCounters();
+	};
+
+#ifdef __linux__
+	static int open(std::uint32_t type, std::uint64_t config) {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+#endif
+
+	threadCounters::threadCounters() {
+		for (int i = 0; i < EVENTS; ++i) {
+			fds[i] = -1;
+		}
+#ifdef __linux__
+		auto cache = [](std::uint64_t id) {
+			return id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		};
+		fds[TASK_CLOCK] = open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+		fds[CYCLES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		fds[INSTRUCTIONS] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		fds[BRANCH_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+		fds[L1D_MISSES] = open(PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D));
+		fds[LLC_MISSES] = open(PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL));
+		std::lock_guard<std::mutex> lock(totalsMutex);
+		for (int i = 0; i < EVENTS; ++i) {
+			available[i] = available[i] || fds[i] >= 0;
+		}
+#endif
+	}
+
+	threadCounters::~threadCounters() {
+#ifdef __linux__
+		for (int i = 0; i < EVENTS; ++i) {
+			if (fds[i] >= 0) {
+				close(fds[i]);
+			}
+		}
+#endif
+	}
+
+	// current value of every counter of the calling thread. when
+	// there are more events than hardware counters, the kernel
+	// takes turns counting them, so values are scaled by the time
+	// they were actually counted
+	static void read(long long* values) {
+		static thread_local threadCounters local;
+		for (int i = 0; i < EVENTS; ++i) {
+			values[i] = 0;
+#ifdef __linux__
+			std::uint64_t data[3];
+			if (local.fds[i] >= 0 && ::read(local.fds[i], data, sizeof(data)) == (ssize_t)sizeof(data) && data[2] > 0) {
+				values[i] = (long long)((double)data[0] * data[1] / data[2]);
+			}
+#endif
+		}
+		values[EVALUATIONS] = fractal::evaluations;
+	}
+
+	void start() {
+		enabled = true;
+	}
+
+	scope::scope(phase which) {
+		this->which = enabled ? which : -1;
+		if (this->which >= 0) {
+			read(begin);
+		}
+	}
+
+	scope::~scope() {
+		if (which < 0) {
+			return;
+		}
+		long long end[EVENTS + 1];
+		read(end);
+		std::lock_guard<std::mutex> lock(totalsMutex);
+		for (int i = 0; i <= EVENTS; ++i) {
+			totals[which][i] += end[i] - begin[i];
+		}
+	}
+
+	void report() {
+		if (!enabled) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(totalsMutex);
+		bool any = false, hardware = false;
+		for (int i = 0; i < EVENTS; ++i) {
+			any = any || available[i];
+			hardware = hardware || (i != TASK_CLOCK && available[i]);
+		}
+		if (!any) {
+			std::cout << "[-] Performance counters aren't available on this system.\n";
+			return;
+		}
+
+		//
+		// one row per counter and one column per phase
+		//
+		auto row = [&](std::string name, int e, bool perMillion) {
+			std::cout << "    " << std::left << std::setw(16) << name << std::right;
+			for (int p = 0; p < PHASES; ++p) {
+				std::ostringstream cell;
+				double evaluations = (double)totals[p][EVALUATIONS];
+				if (e < EVENTS && !available[e]) {
+					cell << "n/a";
+				} else if (perMillion) {
+					if (evaluations > 0.0) {
+						cell << std::fixed << std::setprecision(0) << totals[p][e] / (evaluations / 1e6);
+					} else {
+						cell << "-";
+					}
+				} else if (e == TASK_CLOCK) {
+					cell << std::fixed << std::setprecision(1) << totals[p][e] / 1e6;
+				} else {
+					cell << totals[p][e];
+				}
+				std::cout << std::setw(16) << cell.str();
+			}
+			std::cout << "\n";
+		};
+
+		std::cout << "[+] Performance counters per phase:\n";
+		std::cout << "    " << std::setw(16) << "";
+		for (int p = 0; p < PHASES; ++p) {
+			std::cout << std::setw(16) << phaseNames[p];
+		}
+		std::cout << "\n";
+		row("de calls", EVALUATIONS, false);
+		row("cpu ms", TASK_CLOCK, false);
+		row("cycles", CYCLES, false);
+		row("instructions", INSTRUCTIONS, false);
+		std::cout << "    " << std::left << std::setw(16) << "ipc" << std::right;
+		for (int p = 0; p < PHASES; ++p) {
+			std::ostringstream cell;
+			if (available[CYCLES] && available[INSTRUCTIONS] && totals[p][CYCLES] > 0) {
+				cell << std::fixed << std::setprecision(2) << (double)totals[p][INSTRUCTIONS] / totals[p][CYCLES];
+			} else {
+				cell << "n/a";
+			}
+			std::cout << std::setw(16) << cell.str();
+		}
+		std::cout << "\n";
+		row("branch misses", BRANCH_MISSES, false);
+		row("l1d misses", L1D_MISSES, false);
+		row("llc misses", LLC_MISSES, false);
+		std::cout << "    per million distance estimations:\n";
+		row("cycles", CYCLES, true);
+		row("instructions", INSTRUCTIONS, true);
+		row("branch misses", BRANCH_MISSES, true);
+		row("l1d misses", L1D_MISSES, true);
+		row("llc misses", LLC_MISSES, true);
+		if (!hardware) {
+			std::cout << "[-] Hardware counters aren't available. they need a cpu that exposes them, which most virtual machines don't, and a low enough '/proc/sys/kernel/perf_event_paranoid'.\n";
+		}
+	}
+}
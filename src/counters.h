@@ -0,0 +1,44 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#pragma once
+
+namespace counters {
+	// phases counted separately
+	enum phase {
+		CAMERA_SEARCH,
+		RENDER,
+		ENCODE,
+		PHASES
+	};
+
+	// true while counters are being recorded. it's only changed
+	// before any thread is started, so it's read without locking
+	extern bool enabled;
+
+	// start recording counters
+	extern void start();
+
+	// print every phase's totals, and the same totals per million
+	// distance estimations. counters the system doesn't provide
+	// are shown as 'n/a'
+	extern void report();
+
+	// counts the cycles, instructions, branch misses, l1 data and
+	// last level cache misses and distance estimations of the
+	// calling thread between its construction and destruction, and
+	// adds them to a phase. counters are opened through
+	// perf_event_open once per thread. costs a single branch when
+	// counting is disabled
+	class scope {
+		private:
+			int which;
+			long long begin[8];
+
+		public:
+			scope(phase which);
+			~scope();
+	};
+}
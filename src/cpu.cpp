@@ -0,0 +1,119 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#include "cpu.h"
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace cpu {
+	// read a single integer from a sysfs file
+	static int readTopology(int cpu, std::string name) {
+		std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/" + name);
+		int value = -1;
+		file >> value;
+		return value;
+	}
+
+	std::vector<int> coreOrder() {
+		std::vector<int> cpus;
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+			for (int i = 0; i < CPU_SETSIZE; ++i) {
+				if (CPU_ISSET(i, &set)) {
+					cpus.push_back(i);
+				}
+			}
+		}
+#endif
+		if (cpus.empty()) {
+			int n = std::max(1u, std::thread::hardware_concurrency());
+			for (int i = 0; i < n; ++i) {
+				cpus.push_back(i);
+			}
+			return cpus;
+		}
+
+		//
+		// rank every logical cpu among the ones sharing its physical
+		// core, and every core among the ones in its socket. then
+		// sort by sibling rank first so that physical cores come
+		// before hyperthreads, and by core rank next so that sockets
+		// alternate
+		//
+		std::map<std::pair<int, int>, int> siblings;
+		std::map<int, int> socketCores;
+		std::map<std::pair<int, int>, int> coreRanks;
+		std::vector<std::tuple<int, int, int, int>> keys;
+		for (int c : cpus) {
+			int socket = readTopology(c, "physical_package_id");
+			int core = readTopology(c, "core_id");
+			std::pair<int, int> id(socket, core);
+			if (!coreRanks.count(id)) {
+				coreRanks[id] = socketCores[socket]++;
+			}
+			keys.push_back(std::make_tuple(siblings[id]++, coreRanks[id], socket, c));
+		}
+		std::sort(keys.begin(), keys.end());
+		for (int i = 0; i < (int)keys.size(); ++i) {
+			cpus[i] = std::get<3>(keys[i]);
+		}
+		return cpus;
+	}
+
+	bool pin(int cpu) {
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	pinned::pinned(int cpu) {
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (cpu < 0 || pthread_getaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+			return;
+		}
+		for (int i = 0; i < CPU_SETSIZE; ++i) {
+			if (CPU_ISSET(i, &set)) {
+				previous.push_back(i);
+			}
+		}
+		if (!pin(cpu)) {
+			previous.clear();
+		}
+#endif
+	}
+
+	pinned::~pinned() {
+#ifdef __linux__
+		if (previous.empty()) {
+			return;
+		}
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int i : previous) {
+			CPU_SET(i, &set);
+		}
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+	}
+}
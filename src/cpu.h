@@ -0,0 +1,33 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#pragma once
+
+#include <vector>
+
+namespace cpu {
+	// logical cpus the process is allowed to run on, ordered so
+	// that every physical core appears once before any of its
+	// hyperthread siblings, and cores of different sockets
+	// alternate
+	extern std::vector<int> coreOrder();
+
+	// pin the calling thread to a logical cpu. returns false if
+	// it's not supported on this system
+	extern bool pin(int cpu);
+
+	// pins the calling thread to a logical cpu for as long as it
+	// lives, then lets it run on the cpus it was allowed to before,
+	// so that threads it creates afterwards aren't pinned too. does
+	// nothing if 'cpu' is negative
+	class pinned {
+		private:
+			std::vector<int> previous;
+
+		public:
+			pinned(int cpu);
+			~pinned();
+	};
+}
@@ -5,64 +5,208 @@
 
 #include "fractal.h"
 #include "seed.h"
+#include "config.h"
 
+#include <algorithm>
 #include <iostream>
 
-//                                                            //
-//======== p o l y m o r p h i c    i t e r a t o r s ========//
-//                                                            //
-
-struct PI0 : pointIterator {
-	PI0(double xs, double zs, double xrs, double xrc, double zrs, double zrc) : pointIterator(xs, zs, xrs, xrc, zrs, zrc) {}
-	inline void iterate(math::vec3& point) {
-		point = math::absolute(point);
-		math::rotation::x(point, xrs, xrc);
-		math::rotation::z(point, zrs, zrc);
-		math::fold::menger(point);
-		math::rotation::z(point, zrs, zrc);
-		math::rotation::x(point, xrs, xrc);
-		math::fold::sierpinski(point);
-		point.x += xs;
-		point.z += zs;
+//                                                  //
+//======== f o r m u l a    k e r n e l s ========//
+//                                                  //
+
+// a single operation, resolved at compile time
+template <int code>
+static void apply(const formulaOp& op, math::vec3& point);
+
+template <>
+void apply<OP_ABSOLUTE>(const formulaOp&, math::vec3& point) {
+	point = math::absolute(point);
+}
+
+template <>
+void apply<OP_ROTATE_X>(const formulaOp& op, math::vec3& point) {
+	math::rotation::x(point, op.v.x, op.v.y);
+}
+
+template <>
+void apply<OP_ROTATE_Y>(const formulaOp& op, math::vec3& point) {
+	math::rotation::y(point, op.v.x, op.v.y);
+}
+
+template <>
+void apply<OP_ROTATE_Z>(const formulaOp& op, math::vec3& point) {
+	math::rotation::z(point, op.v.x, op.v.y);
+}
+
+template <>
+void apply<OP_MENGER>(const formulaOp&, math::vec3& point) {
+	math::fold::menger(point);
+}
+
+template <>
+void apply<OP_SIERPINSKI>(const formulaOp&, math::vec3& point) {
+	math::fold::sierpinski(point);
+}
+
+template <>
+void apply<OP_SHIFT>(const formulaOp& op, math::vec3& point) {
+	point.x += op.v.x;
+	point.y += op.v.y;
+	point.z += op.v.z;
+}
+
+// generic kernel. a single switch per operation
+static void interpretedKernel(const formulaOp* ops, int count, math::vec3& point, int iters) {
+	for (int i = 0; i < iters; ++i) {
+		for (int j = 0; j < count; ++j) {
+			const formulaOp& op = ops[j];
+			switch (op.code) {
+				case OP_ABSOLUTE:
+					apply<OP_ABSOLUTE>(op, point);
+					break;
+				case OP_ROTATE_X:
+					apply<OP_ROTATE_X>(op, point);
+					break;
+				case OP_ROTATE_Y:
+					apply<OP_ROTATE_Y>(op, point);
+					break;
+				case OP_ROTATE_Z:
+					apply<OP_ROTATE_Z>(op, point);
+					break;
+				case OP_MENGER:
+					apply<OP_MENGER>(op, point);
+					break;
+				case OP_SIERPINSKI:
+					apply<OP_SIERPINSKI>(op, point);
+					break;
+				case OP_SHIFT:
+					apply<OP_SHIFT>(op, point);
+					break;
+			}
+		}
 	}
-};
+}
 
-struct PI1 : pointIterator {
-	PI1(double xs, double zs, double xrs, double xrc, double zrs, double zrc) : pointIterator(xs, zs, xrs, xrc, zrs, zrc) {}
-	inline void iterate(math::vec3& point) {
-		point = math::absolute(point);
-		math::rotation::z(point, zrs, zrc);
-		math::rotation::x(point, xrs, xrc);
-		math::fold::sierpinski(point);
-		math::rotation::x(point, xrs, xrc);
-		math::rotation::z(point, zrs, zrc);
-		math::fold::menger(point);
-		point.x += xs;
-		point.z += zs;
+// kernel specialized for a fixed sequence of operations. the
+// sequence is known at compile time, so every switch goes away and
+// only the parameters are read from the operation list. the count
+// is the length of the sequence, so it's left unnamed
+template <int... codes>
+static void fixedKernel(const formulaOp* ops, int, math::vec3& point, int iters) {
+	for (int i = 0; i < iters; ++i) {
+		const formulaOp* op = ops;
+		int expand[] = { (apply<codes>(*op++, point), 0)... };
+		(void)expand;
 	}
+}
+
+// the formulas generated by seeds, which used to be hard coded
+// point iterators
+struct fastPath {
+	std::vector<int> codes;
+	formulaKernel kernel;
 };
 
-struct PI2 : pointIterator {
-	PI2(double xs, double zs, double xrs, double xrc, double zrs, double zrc) : pointIterator(xs, zs, xrs, xrc, zrs, zrc) {}
-	inline void iterate(math::vec3& point) {
-		point = math::absolute(point);
-		math::rotation::z(point, zrs, zrc);
-		math::rotation::x(point, xrs, xrc);
-		math::fold::sierpinski(point);
-		math::fold::menger(point);
-		math::rotation::x(point, xrs, xrc);
-		math::rotation::z(point, zrs, zrc);
-		point.x += xs;
-		point.z += zs;
+static const std::vector<fastPath> fastPaths = {
+	{
+		{ OP_ABSOLUTE, OP_ROTATE_X, OP_ROTATE_Z, OP_MENGER, OP_ROTATE_Z, OP_ROTATE_X, OP_SIERPINSKI, OP_SHIFT },
+		fixedKernel<OP_ABSOLUTE, OP_ROTATE_X, OP_ROTATE_Z, OP_MENGER, OP_ROTATE_Z, OP_ROTATE_X, OP_SIERPINSKI, OP_SHIFT>
+	},
+	{
+		{ OP_ABSOLUTE, OP_ROTATE_Z, OP_ROTATE_X, OP_SIERPINSKI, OP_ROTATE_X, OP_ROTATE_Z, OP_MENGER, OP_SHIFT },
+		fixedKernel<OP_ABSOLUTE, OP_ROTATE_Z, OP_ROTATE_X, OP_SIERPINSKI, OP_ROTATE_X, OP_ROTATE_Z, OP_MENGER, OP_SHIFT>
+	},
+	{
+		{ OP_ABSOLUTE, OP_ROTATE_Z, OP_ROTATE_X, OP_SIERPINSKI, OP_MENGER, OP_ROTATE_X, OP_ROTATE_Z, OP_SHIFT },
+		fixedKernel<OP_ABSOLUTE, OP_ROTATE_Z, OP_ROTATE_X, OP_SIERPINSKI, OP_MENGER, OP_ROTATE_X, OP_ROTATE_Z, OP_SHIFT>
 	}
 };
 
+//
+// lower a formula as stored in a seed into a flat list of
+// operations. angles become sines and cosines, consecutive shifts
+// become a single vector shift, and operations which don't change
+// anything are dropped
+//
+static std::vector<formulaOp> lowerFormula(const std::vector<std::pair<int, double>>& source) {
+	std::vector<formulaOp> ops;
+	for (auto& s : source) {
+		formulaOp op;
+		op.code = s.first;
+		switch (s.first) {
+			case OP_ABSOLUTE:
+				if (!ops.empty() && ops.back().code == OP_ABSOLUTE) {
+					continue;
+				}
+				break;
+			case OP_ROTATE_X:
+			case OP_ROTATE_Y:
+			case OP_ROTATE_Z:
+				if (s.second == 0.0) {
+					continue;
+				}
+				op.v = math::vec3(std::sin(s.second), std::cos(s.second), 0.0);
+				break;
+			case OP_MENGER:
+			case OP_SIERPINSKI:
+				break;
+			case OP_SHIFT_X:
+			case OP_SHIFT_Y:
+			case OP_SHIFT_Z: {
+				if (s.second == 0.0) {
+					continue;
+				}
+				math::vec3 shift(0.0);
+				(s.first == OP_SHIFT_X ? shift.x : s.first == OP_SHIFT_Y ? shift.y : shift.z) = s.second;
+				if (!ops.empty() && ops.back().code == OP_SHIFT) {
+					ops.back().v += shift;
+					continue;
+				}
+				op.code = OP_SHIFT;
+				op.v = shift;
+				break;
+			}
+			default:
+				// unknown operation, rejected when parsing seeds
+				continue;
+		}
+		ops.push_back(op);
+	}
+	return ops;
+}
+
 //                                            //
 //======== f r a c t a l    c l a s s ========//
 //                                            //
 
+// smallest singular value of the 2x2 matrix applied by the in
+// place rotations in math::rotation, which use the already
+// rotated first coordinate to compute the second one
+static double shearedScale(double s, double c) {
+	double a = c, b = s;
+	double d = -c * s, e = c - s * s;
+	double p = a * a + d * d;
+	double q = a * b + d * e;
+	double r = b * b + e * e;
+	double half = (p + r) / 2.0;
+	return std::sqrt(std::max(0.0, half - std::sqrt(std::max(0.0, half * half - (p * r - q * q)))));
+}
+
+thread_local long long fractal::evaluations = 0;
+thread_local long long fractal::rays = 0;
+
 fractal::fractal(seed* s) : s(s) {
 
+	//
+	// get maximum steps per marched ray from config file
+	//
+	stepBudget = config::getInt("budget");
+
+	//
+	// whether shadow rays are clipped against the bounding sphere
+	//
+	bounds = config::getInt("bounds");
+
 	//
 	// get number of fractal iterations
 	//
@@ -104,68 +248,154 @@ fractal::fractal(seed* s) : s(s) {
 	}
 
 	//
-	// determine fractal shift variation vector per iteration
-	//
-	xs = s->values["xshift"];
-	zs = s->values["zshift"];
-	
+	// get the formula applied on every iteration. seeds can carry
+	// their own sequence of operations. the ones that don't are
+	// built from one of the original point iterators, with the
+	// seed's shift and rotation per iteration
 	//
-	// determine fractal rotation per iteration
-	//
-	xr = s->values["xrotation"];
-	zr = s->values["zrotation"];
+	std::vector<std::pair<int, double>> source;
+	int length = s->values.count("formulaLength") ? (int)s->values["formulaLength"] : 0;
+	if (length > 0) {
+		for (int i = 0; i < length; ++i) {
+			std::string op = "formula" + std::to_string(i);
+			source.push_back({ (int)s->values[op + "op"], s->values[op + "param"] });
+		}
+	} else {
+		double xs = s->values["xshift"];
+		double zs = s->values["zshift"];
+		double xr = s->values["xrotation"];
+		double zr = s->values["zrotation"];
+		switch ((int)s->values["pointIterator"]) {
+			case 0:
+				source = { { OP_ABSOLUTE, 0.0 }, { OP_ROTATE_X, xr }, { OP_ROTATE_Z, zr }, { OP_MENGER, 0.0 }, { OP_ROTATE_Z, zr }, { OP_ROTATE_X, xr }, { OP_SIERPINSKI, 0.0 } };
+				break;
+			case 1:
+				source = { { OP_ABSOLUTE, 0.0 }, { OP_ROTATE_Z, zr }, { OP_ROTATE_X, xr }, { OP_SIERPINSKI, 0.0 }, { OP_ROTATE_X, xr }, { OP_ROTATE_Z, zr }, { OP_MENGER, 0.0 } };
+				break;
+			case 2:
+				source = { { OP_ABSOLUTE, 0.0 }, { OP_ROTATE_Z, zr }, { OP_ROTATE_X, xr }, { OP_SIERPINSKI, 0.0 }, { OP_MENGER, 0.0 }, { OP_ROTATE_X, xr }, { OP_ROTATE_Z, zr } };
+				break;
+		}
+		source.push_back({ OP_SHIFT_X, xs });
+		source.push_back({ OP_SHIFT_Z, zs });
+	}
 
 	//
-	// precompute sine and cosine of rotation angles
+	// lower it and pick the fastest kernel able to run it
 	//
-	xrs = std::sin(xr);
-	xrc = std::cos(xr);
-	zrs = std::sin(zr);
-	zrc = std::cos(zr);
+	ops = lowerFormula(source);
+	kernel = interpretedKernel;
+	for (auto& path : fastPaths) {
+		bool match = path.codes.size() == ops.size();
+		for (int i = 0; match && i < (int)ops.size(); ++i) {
+			match = path.codes[i] == ops[i].code;
+		}
+		if (match) {
+			kernel = path.kernel;
+			break;
+		}
+	}
 	
 	//
-	// initialize point iterator
+	// bounding sphere.
+	// absolute values and folds are reflections and don't change
+	// a point's distance to the origin. rotations are implemented
+	// in place, so they're slightly sheared and can shrink it at
+	// most by the smallest singular value of their matrix. shifts
+	// move it by at most the shift length. so after n iterations
+	// a point at distance d is at least at c^n * d minus the sum
+	// of the shifts. the final box reaches sqrt(3) from the
+	// origin, so any point farther than the resulting radius
+	// can't be inside the fractal
 	//
-	switch ((int)s->values["pointIterator"]) {
-		case 0:
-			mainPI = new PI0(xs, zs, xrs, xrc, zrs, zrc);
-			break;
-		case 1:
-			mainPI = new PI1(xs, zs, xrs, xrc, zrs, zrc);
-			break;
-		case 2:
-			mainPI = new PI2(xs, zs, xrs, xrc, zrs, zrc);
-			break;
+	double c = 1.0;
+	double shift = 0.0;
+	for (auto& op : ops) {
+		if (op.code == OP_ROTATE_X || op.code == OP_ROTATE_Y || op.code == OP_ROTATE_Z) {
+			c *= shearedScale(op.v.x, op.v.y);
+		} else if (op.code == OP_SHIFT) {
+			shift += math::length(op.v);
+		}
 	}
+	double reach = std::sqrt(3.0);
+	for (int i = 0; i < iterations; ++i) {
+		reach = (reach + shift) / c;
+	}
+	boundingRadius = reach;
 }
 
 fractal::~fractal() {
-	delete mainPI;
 }
 
 //
 // main fractal distance estimator
 //
 double fractal::de(math::vec3 point) {
-	for (int i = 0; i < iterations; ++i) {
-		mainPI->iterate(point);
-	}
+	return de(point, iterations);
+}
+
+double fractal::de(math::vec3 point, int iters) {
+	++evaluations;
+	kernel(ops.data(), (int)ops.size(), point, iters);
 	return math::de::box(point, 1.0);
 }
 
+int fractal::getIterations() {
+	return iterations;
+}
+
+bool fractal::clip(math::ray r, double& tmin, double& tmax) {
+	double a = math::dot(r.direction, r.direction);
+	double b = math::dot(r.origin, r.direction);
+	double c = math::dot(r.origin, r.origin) - boundingRadius * boundingRadius;
+	if (a == 0.0) {
+		// a null direction never leaves its origin
+		tmin = 0.0;
+		tmax = 1e20;
+		return true;
+	}
+	double discriminant = b * b - a * c;
+	if (discriminant < 0.0) {
+		return false;
+	}
+	double root = std::sqrt(discriminant);
+	tmin = (-b - root) / a;
+	tmax = (-b + root) / a;
+	return tmax > 0.0;
+}
+
 double fractal::calculateShadow(math::ray r) {
+	return calculateShadow(r, iterations, 0.001);
+}
+
+double fractal::calculateShadow(math::ray r, int iters, double eps) {
+	return calculateShadow(r, iters, eps, 16.0);
+}
+
+double fractal::calculateShadow(math::ray r, int iters, double eps, double tmax) {
+	++rays;
 	double res = 1.0;
 	double ph = 1e20;
-	double tmax = 16.0;
 	double t = 0.0001;
 
+	//
+	// nothing can block the ray once it leaves the bounding sphere
+	//
+	if (bounds) {
+		double enter, exit;
+		if (!clip(r, enter, exit)) {
+			return res;
+		}
+		tmax = std::min(tmax, exit);
+	}
+
 	//
 	// kinda like raymarching the shadow with some fancy modifiers
 	// to make it soft and round
 	//
-	for(; t < tmax; ) {
-		double h = de(r.origin + r.direction * t);
-		if (h < 0.001) {
+	for(int steps = 0; t < tmax && (stepBudget <= 0 || steps < stepBudget); ++steps) {
+		double h = de(r.origin + r.direction * t, iters);
+		if (h < eps) {
 			return 0.0;
 		}
 		double y = h * h / (2.0 * ph);
@@ -178,22 +408,45 @@ double fractal::calculateShadow(math::ray r) {
 	return res;
 }
 
+double fractal::calculateOcclusion(math::vec3 point, math::vec3 normal, int iters) {
+	double occlusion = 0.0;
+	double weight = 1.0;
+	for (int i = 1; i <= 5; ++i) {
+		double h = 0.01 * i * i;
+		occlusion += (h - de(point + normal * h, iters)) * weight;
+		weight *= 0.5;
+	}
+	return std::min(1.0, std::max(0.0, 1.0 - 4.0 * occlusion));
+}
+
 math::vec3 fractal::calculateColor(math::vec3 point) {
-	mainPI->iterate(point);
-	math::vec3 pc = point * color;
+	return colorOfTrap(calculateTrap(point));
+}
+
+math::vec3 fractal::calculateTrap(math::vec3 point) {
+	kernel(ops.data(), (int)ops.size(), point, 1);
+	return point;
+}
+
+math::vec3 fractal::colorOfTrap(math::vec3 trap) {
+	math::vec3 pc = trap * color;
 	return math::vec3(std::max(0.0, pc.x), std::max(0.0, pc.y), std::max(0.0, pc.z));
 }
 
 math::vec3 fractal::calculateNormal(math::vec3 point) {
+	return calculateNormal(point, iterations);
+}
+
+math::vec3 fractal::calculateNormal(math::vec3 point, int iters) {
 	double e = 0.00001;
 	math::vec3 xyy(1.0, -1.0, -1.0);
 	math::vec3 yyx(-1.0, -1.0, 1.0);
 	math::vec3 yxy(-1.0, 1.0, -1.0);
 	math::vec3 xxx(1.0, 1.0, 1.0);
 	return math::normalize(
-				xyy * de(point + xyy * e) +
-				yyx * de(point + yyx * e) +
-				yxy * de(point + yxy * e) +
-				xxx * de(point + xxx * e)
+				xyy * de(point + xyy * e, iters) +
+				yyx * de(point + yyx * e, iters) +
+				yxy * de(point + yxy * e, iters) +
+				xxx * de(point + xxx * e, iters)
 				);
 }
@@ -10,37 +10,53 @@
 #include <vector>
 #include <string>
 
-struct pointIterator {
-	double xs;
-	double zs;
-	double xrs;
-	double xrc;
-	double zrs;
-	double zrc;
-	pointIterator(double xs, double zs, double xrs, double xrc, double zrs, double zrc) : xs(xs), zs(zs), xrs(xrs), xrc(xrc), zrs(zrs), zrc(zrc) {}
-	virtual void iterate(math::vec3& point) = 0;
+// operations of a fractal formula, as stored in seeds. every
+// operation takes one parameter: an angle for rotations and an
+// amount for shifts. the others ignore it
+enum formulaCode {
+	OP_ABSOLUTE,
+	OP_ROTATE_X,
+	OP_ROTATE_Y,
+	OP_ROTATE_Z,
+	OP_MENGER,
+	OP_SIERPINSKI,
+	OP_SHIFT_X,
+	OP_SHIFT_Y,
+	OP_SHIFT_Z,
+	// only produced when lowering, shifts along every axis at once
+	OP_SHIFT
 };
 
+// single operation of a lowered formula. rotations store the sine
+// and cosine of their angle in x and y, and shifts store their
+// vector
+struct formulaOp {
+	int code;
+	math::vec3 v;
+};
+
+// runs 'iters' iterations of a lowered formula on a point
+typedef void (*formulaKernel)(const formulaOp* ops, int count, math::vec3& point, int iters);
+
 class fractal {
 	private:
 		// fractal's variables. randomly set at runtime
 		int iterations;
-		double xs;
-		double zs;
-		double xr;
-		double zr;
-		double xrs;
-		double xrc;
-		double zrs;
-		double zrc;
 		double shadowSoftness;
+		double boundingRadius;
+		int stepBudget;
+		int bounds;
 		math::vec3 color;
 
 		// seed pointer
 		seed* s;
 
-		// polymorphic point iterator
-		pointIterator* mainPI;
+		// formula applied to a point on every iteration, lowered
+		// into a flat list of operations, and the kernel running
+		// it. common formulas get a kernel specialized for their
+		// exact sequence of operations
+		std::vector<formulaOp> ops;
+		formulaKernel kernel;
 
 	public:
 		math::vec3 gradientTop;
@@ -49,9 +65,27 @@ class fractal {
 		fractal(seed* s);
 		~fractal();
 
+		// number of distance estimator evaluations and of marched
+		// rays, shadow rays included, done by the calling thread.
+		// used to measure the cost of pixels
+		static thread_local long long evaluations;
+		static thread_local long long rays;
+
 		// main distance estimator
 		double de(math::vec3 point);
 
+		// distance estimator truncated to the first 'iters'
+		// iterations. used for level of detail
+		double de(math::vec3 point, int iters);
+
+		// number of iterations of the full distance estimator
+		int getIterations();
+
+		// clip a ray against the fractal's bounding sphere. returns
+		// false if the ray misses it, otherwise stores the range of
+		// distances along the ray that lies inside the sphere
+		bool clip(math::ray r, double& tmin, double& tmax);
+
 		//
 		// smooth shadowing technique. 
 		// explained in detal at inigo quilez's blog:
@@ -59,9 +93,31 @@ class fractal {
 		//
 		double calculateShadow(math::ray r);
 
+		// same as above, with a truncated distance estimator and
+		// a custom distance at which the ray is considered blocked.
+		// rays that run out of step budget keep the penumbra they
+		// gathered so far
+		double calculateShadow(math::ray r, int iters, double eps);
+
+		// same as above, giving up once the ray has travelled 'tmax'
+		// without being blocked
+		double calculateShadow(math::ray r, int iters, double eps, double tmax);
+
+		// ambient occlusion. samples the distance estimator a few
+		// times along the normal and compares it with the distance
+		// travelled. 1 for an open surface, down to 0 for a fully
+		// occluded one. explained at inigo quilez's blog:
+		// https://iquilezles.org/www/material/nvscene2008/rwwtt.pdf
+		double calculateOcclusion(math::vec3 point, math::vec3 normal, int iters);
+
 		// fractal coloring using the orbit trap technique
 		math::vec3 calculateColor(math::vec3 point);
 
+		// the same, in two steps: the orbit trap of a point, which
+		// only depends on the geometry, and its color
+		math::vec3 calculateTrap(math::vec3 point);
+		math::vec3 colorOfTrap(math::vec3 trap);
+
 		// tetrahedron technique used to calculate normals instead of
 		// the classical forward and central differences technique.
 		// the main difference is the amount of calls to the DE function
@@ -69,4 +125,5 @@ class fractal {
 		// explained in detal at inigo quilez blog:
 		// https://www.iquilezles.org/www/articles/normalsSDF/normalsSDF.htm
 		math::vec3 calculateNormal(math::vec3 point);
+		math::vec3 calculateNormal(math::vec3 point, int iters);
 };
@@ -5,8 +5,11 @@
 
 #include "gui.h"
 
-#include <thread>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
 #include <cstdlib>
+#include <string>
 
 namespace gui {
 	bool setup() {
@@ -47,24 +50,80 @@ namespace gui {
 		return true;
 	}
 	
-	void update(int* curV, int tarV) {
-		double lockedValue = *curV;
+	// human readable rate, like 12.3M
+	static std::string rate(double v) {
+		const char* units[] = { "", "K", "M", "G", "T" };
+		int unit = 0;
+		for (; v >= 1000.0 && unit < 4; ++unit) {
+			v /= 1000.0;
+		}
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.1f%s", v, units[unit]);
+		return buffer;
+	}
+
+	finish::finish() : done(false) {
+	}
+
+	void finish::set() {
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+		changed.notify_all();
+	}
+
+	bool finish::wait(int milliseconds) {
+		std::unique_lock<std::mutex> guard(lock);
+		return changed.wait_for(guard, std::chrono::milliseconds(milliseconds), [this] { return done; });
+	}
+
+	void update(std::vector<progress>* counters, long long total, int format, finish* done) {
+		auto start = std::chrono::steady_clock::now();
+		bool finished = false;
 
 		do {
-			lockedValue = *curV;
+			finished = done->wait(250);
+
+			//
+			// aggregate every thread's counters. they're relaxed, so
+			// the values might be slightly out of date, but never
+			// torn
+			//
+			long long pixels = 0, rays = 0, evaluations = 0;
+			for (auto& c : *counters) {
+				pixels += c.pixels.load(std::memory_order_relaxed);
+				rays += c.rays.load(std::memory_order_relaxed);
+				evaluations += c.evaluations.load(std::memory_order_relaxed);
+			}
+			double elapsed = std::max(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), 1e-6);
+			double percent = total ? 100.0 * pixels / total : 100.0;
+			double eta = pixels ? elapsed * (total - pixels) / pixels : 0.0;
+
+			if (format == 1) {
+				std::cerr << "{\"pixels\":" << pixels << ",\"total\":" << total;
+				std::cerr << ",\"percent\":" << percent << ",\"elapsed\":" << elapsed;
+				std::cerr << ",\"rays_per_second\":" << rays / elapsed;
+				std::cerr << ",\"evaluations_per_second\":" << evaluations / elapsed;
+				std::cerr << ",\"eta\":" << eta << "}" << std::endl;
+				continue;
+			}
+
 			// width of logo is 34 characters. two of which
 			// will be used for the extremes of the bar.
 			// terminal colors are represented with expressions
 			// like "\033[x;xx"
 			std::cout << "\r\033[1;36m[";
-			int quantity = 1 + 32 * lockedValue / tarV;
+			int quantity = 1 + 32 * pixels / std::max(total, 1LL);
 			for (int i = 0; i < 32; ++i) {
 				std::cout << (i < quantity ? "\033[1;36m=" : "\033[0m-");
 			}
-			std::cout << "\033[1;36m]";
+			std::cout << "\033[1;36m] \033[0;36m" << (int)percent << "% ";
+			std::cout << rate(rays / elapsed) << " rays/s ";
+			std::cout << rate(evaluations / elapsed) << " de/s ";
+			std::cout << "eta " << (long long)eta << "s   ";
 			std::cout.flush();
-			std::this_thread::sleep_for(std::chrono::milliseconds(5));
-		} while (lockedValue < tarV);
-		std::cout << "\033[0;36m\n";
+		} while (!finished);
+		if (format != 1) {
+			std::cout << "\033[0;36m\n";
+		}
 	}
 }
@@ -3,9 +3,46 @@
  * Copyright (c) 2020 Pablo Peñarroja
  */
 
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
+#include <mutex>
+#include <vector>
 
 namespace gui {
+	// progress of a single render thread. only its own thread
+	// writes to it, and it takes a whole cache line so that
+	// threads don't slow each other down by sharing one
+	struct alignas(64) progress {
+		std::atomic<long long> pixels;
+		std::atomic<long long> rays;
+		std::atomic<long long> evaluations;
+		progress() : pixels(0), rays(0), evaluations(0) {}
+	};
+
+	// set by the render once every thread is done, which wakes
+	// 'update' up right away instead of at its next report
+	class finish {
+		private:
+			std::mutex lock;
+			std::condition_variable changed;
+			bool done;
+
+		public:
+			finish();
+			void set();
+
+			// wait up to 'milliseconds' for it to be set. returns
+			// whether it was
+			bool wait(int milliseconds);
+	};
+
 	extern bool setup();
-	extern void update(int* curV, int tarV);
+
+	// report the progress of every render thread out of 'total'
+	// pixels every 250ms until 'done' is set. 'format' 0 draws the
+	// progress bar, and 1 writes one json object per line to stderr
+	extern void update(std::vector<progress>* counters, long long total, int format, finish* done);
 }
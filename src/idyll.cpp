@@ -0,0 +1,210 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#include "idyll.h"
+#include "config.h"
+#include "fractal.h"
+#include "image.h"
+#include "renderer.h"
+#include "seed.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct idyll_renderer {
+	seed* s;
+	fractal* f;
+	renderer* r;
+	int width;
+	int height;
+	// unstratified samplers draw from the seed's rng, which isn't
+	// thread safe, so their renders take turns on this lock
+	bool stratified;
+	std::mutex serial;
+	// bumped by every cancel. renders stop once it changes
+	std::atomic<long long> generation;
+};
+
+// renderers read their settings from the config overrides when
+// they're constructed, so creation is serialized
+static std::mutex creation;
+
+// region being rendered, shared by every row task
+struct idyll_region {
+	idyll_renderer* r;
+	int x;
+	int y;
+	int width;
+	float* floats;
+	uint8_t* bytes;
+	size_t stride;
+	double exposure;
+	double gamma;
+	long long generation;
+	std::atomic<bool> cancelled;
+};
+
+static void renderRow(void* data, int i) {
+	idyll_region* g = (idyll_region*)data;
+	std::vector<float> buffer;
+	float* row = g->floats ? g->floats + (size_t)i * g->stride : nullptr;
+	if (!row) {
+		buffer.resize((size_t)g->width * 3);
+		row = buffer.data();
+	}
+	double y = (double)g->r->height - ((double)(g->y + i) + 0.5);
+	for (int x = 0; x < g->width; ++x) {
+		if (g->r->generation.load(std::memory_order_relaxed) != g->generation) {
+			g->cancelled = true;
+			return;
+		}
+		math::vec3 pixel = g->r->r->render(y, (double)(g->x + x) + 0.5);
+		row[x * 3 + 0] = (float)pixel.x;
+		row[x * 3 + 1] = (float)pixel.y;
+		row[x * 3 + 2] = (float)pixel.z;
+	}
+	if (g->bytes) {
+		image::tonemap(row, g->bytes + (size_t)i * g->stride, g->width, g->exposure, g->gamma);
+	}
+}
+
+static int renderRegion(idyll_region& g, int height, const idyll_pool* pool) {
+	idyll_renderer* r = g.r;
+	if (g.x < 0 || g.y < 0 || g.width < 0 || height < 0 || g.x + g.width > r->width || g.y + height > r->height || g.stride < (size_t)g.width * 3) {
+		return IDYLL_INVALID;
+	}
+	std::unique_lock<std::mutex> lock(r->serial, std::defer_lock);
+	if (!r->stratified) {
+		if (pool && pool->parallel_for) {
+			return IDYLL_INVALID;
+		}
+		lock.lock();
+	}
+	g.generation = r->generation.load();
+	g.cancelled = false;
+	if (pool && pool->parallel_for) {
+		pool->parallel_for(pool->context, height, renderRow, &g);
+	} else {
+		for (int i = 0; i < height; ++i) {
+			renderRow(&g, i);
+		}
+	}
+	return g.cancelled ? IDYLL_CANCELLED : IDYLL_OK;
+}
+
+void idyll_default_settings(idyll_settings* settings) {
+	settings->width = 1920;
+	settings->height = 1080;
+	settings->samples = 4;
+	settings->clamp = 1;
+	settings->sampler = 1;
+	settings->shading = 0;
+	settings->fov = 45;
+	settings->bounces = 2;
+	settings->roulette = 2;
+	settings->bounds = 1;
+	settings->lod = 0;
+	settings->budget = 0;
+	settings->irradiance = 0.0;
+}
+
+idyll_renderer* idyll_create(const char* seedText, const idyll_settings* settings) {
+	if (!settings || settings->width <= 0 || settings->height <= 0 || settings->samples <= 0 || settings->bounces <= 0 || settings->fov <= 0 || settings->fov >= 180) {
+		return nullptr;
+	}
+	// random seeds are parsed back from their stored form, so that
+	// the text idyll_seed gives renders the same image
+	seed* s = new seed(seedText ? std::string(seedText) : seed().buildSeed());
+	if (seedText && !s->seedParsingSuccessful) {
+		delete s;
+		return nullptr;
+	}
+
+	std::lock_guard<std::mutex> lock(creation);
+	config::set("samples", settings->samples);
+	config::set("clamp", settings->clamp);
+	config::set("sampler", settings->sampler);
+	config::set("shading", settings->shading);
+	config::set("fov", settings->fov);
+	config::set("bounces", settings->bounces);
+	config::set("roulette", settings->roulette);
+	config::set("bounds", settings->bounds);
+	config::set("lod", settings->lod);
+	config::set("budget", settings->budget);
+	config::set("irradiance", settings->irradiance);
+	idyll_renderer* r = new idyll_renderer();
+	r->s = s;
+	r->f = new fractal(s);
+	r->r = new renderer(settings->width, settings->height, s, r->f);
+	r->width = settings->width;
+	r->height = settings->height;
+	r->stratified = settings->sampler != 0;
+	r->generation = 0;
+	return r;
+}
+
+void idyll_destroy(idyll_renderer* r) {
+	if (!r) {
+		return;
+	}
+	delete r->r;
+	delete r->f;
+	delete r->s;
+	delete r;
+}
+
+size_t idyll_seed(const idyll_renderer* r, char* buffer, size_t size) {
+	std::string text = r->s->buildSeed();
+	if (buffer && size > 0) {
+		size_t n = std::min(text.size(), size - 1);
+		std::memcpy(buffer, text.data(), n);
+		buffer[n] = '\0';
+	}
+	return text.size();
+}
+
+int idyll_render_float(idyll_renderer* r, int x, int y, int width, int height, float* pixels, size_t stride, const idyll_pool* pool) {
+	if (!r || !pixels) {
+		return IDYLL_INVALID;
+	}
+	idyll_region g;
+	g.r = r;
+	g.x = x;
+	g.y = y;
+	g.width = width;
+	g.floats = pixels;
+	g.bytes = nullptr;
+	g.stride = stride;
+	g.exposure = 0.0;
+	g.gamma = 1.0;
+	return renderRegion(g, height, pool);
+}
+
+int idyll_render_rgb8(idyll_renderer* r, int x, int y, int width, int height, uint8_t* pixels, size_t stride, double exposure, double gamma, const idyll_pool* pool) {
+	if (!r || !pixels) {
+		return IDYLL_INVALID;
+	}
+	idyll_region g;
+	g.r = r;
+	g.x = x;
+	g.y = y;
+	g.width = width;
+	g.floats = nullptr;
+	g.bytes = pixels;
+	g.stride = stride;
+	g.exposure = exposure;
+	g.gamma = gamma;
+	return renderRegion(g, height, pool);
+}
+
+void idyll_cancel(idyll_renderer* r) {
+	if (r) {
+		r->generation.fetch_add(1);
+	}
+}
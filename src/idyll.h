@@ -0,0 +1,90 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// libidyll. renders seeds inside another program, into buffers owned
+// by the caller. no config.txt file is read and nothing is written
+// to the terminal or to disk
+//
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// return codes of the render functions
+#define IDYLL_OK 0
+#define IDYLL_CANCELLED 1
+#define IDYLL_INVALID -1
+
+// rendering settings. same meaning as the variables of the same
+// name at the config.txt file
+typedef struct idyll_settings {
+	int width;
+	int height;
+	int samples;
+	int clamp;
+	int sampler;
+	int shading;
+	int fov;
+	int bounces;
+	int roulette;
+	int bounds;
+	int lod;
+	int budget;
+	double irradiance;
+} idyll_settings;
+
+// runs 'task(data, i)' for every 'i' from 0 to 'count' - 1, in any
+// order and on any threads, and returns once every call returned.
+// 'context' is passed back untouched
+typedef struct idyll_pool {
+	void (*parallel_for)(void* context, int count, void (*task)(void* data, int i), void* data);
+	void* context;
+} idyll_pool;
+
+typedef struct idyll_renderer idyll_renderer;
+
+// fill 'settings' with the values config.txt starts with
+void idyll_default_settings(idyll_settings* settings);
+
+// create a renderer from a seed, as stored at the seed files, or
+// from a random seed if 'seed' is null. places the camera, so it
+// takes a moment. returns null if the seed or the settings aren't
+// valid. renderers can be created from any thread
+idyll_renderer* idyll_create(const char* seed, const idyll_settings* settings);
+
+void idyll_destroy(idyll_renderer* r);
+
+// copy the renderer's seed into 'buffer', null terminated and
+// truncated to 'size' bytes. returns its full length
+size_t idyll_seed(const idyll_renderer* r, char* buffer, size_t size);
+
+// render the region of 'width' x 'height' pixels starting at the
+// pixel 'x', 'y' of the image, counting from the top left, into
+// 'pixels'. rows are 'stride' elements apart. float buffers get
+// linear, unclamped rgb, and rgb8 buffers get it tonemapped with
+// 'exposure' in stops and 'gamma' as the encoding exponent. rows
+// are rendered in parallel on 'pool', or on the calling thread if
+// it's null. a renderer can render several regions at once.
+// stratified samplers give the same pixels whatever the region and
+// the pool. renderers with 'sampler' 0 share a single rng, so they
+// render one region at a time and return IDYLL_INVALID if given a
+// pool. returns IDYLL_CANCELLED if idyll_cancel was called while
+// rendering, leaving the rest of the region untouched
+int idyll_render_float(idyll_renderer* r, int x, int y, int width, int height, float* pixels, size_t stride, const idyll_pool* pool);
+int idyll_render_rgb8(idyll_renderer* r, int x, int y, int width, int height, uint8_t* pixels, size_t stride, double exposure, double gamma, const idyll_pool* pool);
+
+// cancel every render of 'r' in progress. renders started
+// afterwards aren't affected. can be called from any thread
+void idyll_cancel(idyll_renderer* r);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,253 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+// png lib by Nayuki (https://www.nayuki.io/page/tiny-png-output)
+#include "TinyPngOut.hpp"
+
+#include "image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace image {
+	// pfm files store their byte order in the sign of the scale
+	// factor, so we need to know ours
+	static bool littleEndian() {
+		std::uint16_t probe = 1;
+		return *reinterpret_cast<std::uint8_t*>(&probe) == 1;
+	}
+
+	void tonemap(const float* hdr, std::uint8_t* ldr, std::size_t count, double exposure, double gamma) {
+		//
+		// instead of calling pow for every channel, precompute the
+		// linear value at which every 8-bit output level starts.
+		// then the output is found with a branchless binary search
+		// over those thresholds, which gives exactly the same value
+		// as truncating pow(v, gamma) * 255
+		//
+		float thresholds[256];
+		for (int i = 0; i < 256; ++i) {
+			thresholds[i] = (float)std::pow(i / 255.0, 1.0 / gamma);
+		}
+		float scale = (float)std::pow(2.0, exposure);
+		std::size_t n = count * 3;
+		for (std::size_t i = 0; i < n; ++i) {
+			float v = std::min(std::max(hdr[i] * scale, 0.0f), 1.0f);
+			int b = 0;
+			for (int step = 128; step > 0; step >>= 1) {
+				b += v >= thresholds[b + step] ? step : 0;
+			}
+			ldr[i] = static_cast<std::uint8_t>(b);
+		}
+	}
+
+	void heatmap(const float* values, std::uint8_t* ldr, std::size_t count) {
+		double low = 1e20, high = 0.0;
+		for (std::size_t i = 0; i < count; ++i) {
+			double v = std::log(1.0 + std::max(values[i], 0.0f));
+			low = std::min(low, v);
+			high = std::max(high, v);
+		}
+		double scale = high > low ? 3.0 / (high - low) : 0.0;
+		for (std::size_t i = 0; i < count; ++i) {
+			double v = (std::log(1.0 + std::max(values[i], 0.0f)) - low) * scale;
+			ldr[i * 3 + 0] = static_cast<std::uint8_t>(255.0 * std::min(std::max(v, 0.0), 1.0));
+			ldr[i * 3 + 1] = static_cast<std::uint8_t>(255.0 * std::min(std::max(v - 1.0, 0.0), 1.0));
+			ldr[i * 3 + 2] = static_cast<std::uint8_t>(255.0 * std::min(std::max(v - 2.0, 0.0), 1.0));
+		}
+	}
+
+	bool writePng(std::string path, const std::uint8_t* ldr, int width, int height) {
+		//
+		// convert to portable network graphics format.
+		// all credits for this functionality go to Nayuki for writing
+		// the Tiny PNG Output library:
+		// https://www.nayuki.io/page/tiny-png-output
+		//
+		try {
+			std::ofstream out(path, std::ios::binary);
+			TinyPngOut pngout(static_cast<std::uint32_t>(width), static_cast<std::uint32_t>(height), out);
+			for (int y = 0; y < height; ++y) {
+				pngout.write(ldr + (std::size_t)y * width * 3, static_cast<std::size_t>(width));
+			}
+		} catch (const char* message) {
+			std::cerr << message << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	std::string ppmHeader(int width, int height) {
+		return "P6\n" + std::to_string(width) + ' ' + std::to_string(height) + "\n255\n";
+	}
+
+	std::string pfmHeader(int width, int height) {
+		return pfmHeader(width, height, 3);
+	}
+
+	std::string pfmHeader(int width, int height, int channels) {
+		return (channels == 1 ? "Pf\n" : "PF\n") + std::to_string(width) + ' ' + std::to_string(height) + '\n' + (littleEndian() ? "-1.0" : "1.0") + '\n';
+	}
+
+	bool writePpm(std::string path, const std::uint8_t* ldr, int width, int height) {
+		std::ofstream out(path, std::ios::binary);
+		if (!out.good()) {
+			return false;
+		}
+		out << ppmHeader(width, height);
+		out.write(reinterpret_cast<const char*>(ldr), (std::streamsize)width * height * 3);
+		return out.good();
+	}
+
+	bool writePfm(std::string path, const float* hdr, int width, int height) {
+		return writePfm(path, hdr, width, height, 3);
+	}
+
+	bool writePfm(std::string path, const float* data, int width, int height, int channels) {
+		std::ofstream out(path, std::ios::binary);
+		if (!out.good()) {
+			return false;
+		}
+		out << pfmHeader(width, height, channels);
+		// pfm scanlines go from bottom to top
+		for (int y = height - 1; y >= 0; --y) {
+			out.write(reinterpret_cast<const char*>(data + (std::size_t)y * width * channels), (std::streamsize)width * channels * sizeof(float));
+		}
+		return out.good();
+	}
+
+	bool writeRaw(std::string path, const float* hdr, int width, int height) {
+		return writeFloats(path, hdr, (std::size_t)width * height * 3);
+	}
+
+	bool writeFloats(std::string path, const float* data, std::size_t count) {
+		std::ofstream out(path, std::ios::binary);
+		if (!out.good()) {
+			return false;
+		}
+		out.write(reinterpret_cast<const char*>(data), (std::streamsize)(count * sizeof(float)));
+		return out.good();
+	}
+
+	bool readFloats(std::string path, float* data, std::size_t count) {
+		std::ifstream in(path, std::ios::binary);
+		in.read(reinterpret_cast<char*>(data), (std::streamsize)(count * sizeof(float)));
+		// the file must hold exactly 'count' values
+		return in.good() && in.peek() == std::ifstream::traits_type::eof();
+	}
+
+	bool readPfm(std::string path, std::vector<float>& hdr, int& width, int& height) {
+		std::ifstream in(path, std::ios::binary);
+		std::string magic;
+		double scale;
+		if (!(in >> magic >> width >> height >> scale) || magic != "PF" || width <= 0 || height <= 0) {
+			return false;
+		}
+		// single whitespace character before the raster
+		in.get();
+		std::size_t row = (std::size_t)width * 3;
+		hdr.resize(row * height);
+		for (int y = height - 1; y >= 0; --y) {
+			in.read(reinterpret_cast<char*>(hdr.data() + (std::size_t)y * row), (std::streamsize)(row * sizeof(float)));
+		}
+		if (!in.good()) {
+			return false;
+		}
+		//
+		// swap bytes in case the file was written on a machine with
+		// the opposite byte order
+		//
+		if ((scale < 0.0) != littleEndian()) {
+			for (auto& v : hdr) {
+				std::uint8_t b[4];
+				std::memcpy(b, &v, 4);
+				std::swap(b[0], b[3]);
+				std::swap(b[1], b[2]);
+				std::memcpy(&v, b, 4);
+			}
+		}
+		return true;
+	}
+
+	mappedFile::mappedFile(std::string path, std::size_t size) : bytes(nullptr), size(size) {
+#ifdef _WIN32
+		// no mapping here. the file is filled in memory and written
+		// when it's closed
+		this->path = path;
+		buffer.resize(size);
+		bytes = buffer.data();
+#else
+		int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			return;
+		}
+		if (ftruncate(fd, (off_t)size) == 0) {
+			void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (map != MAP_FAILED) {
+				bytes = static_cast<char*>(map);
+			}
+		}
+		close(fd);
+#endif
+	}
+
+	mappedFile::~mappedFile() {
+#ifdef _WIN32
+		std::ofstream out(path, std::ios::binary);
+		out.write(buffer.data(), (std::streamsize)size);
+#else
+		if (bytes) {
+			munmap(bytes, size);
+		}
+#endif
+	}
+
+	char* mappedFile::data() {
+		return bytes;
+	}
+
+	void fillPpm(mappedFile* file, const float* hdr, int width, int height, std::size_t start, std::size_t count, double exposure, double gamma) {
+		if (!file->data()) {
+			return;
+		}
+		std::uint8_t* raster = reinterpret_cast<std::uint8_t*>(file->data() + ppmHeader(width, height).size());
+		tonemap(hdr + start * 3, raster + start * 3, count, exposure, gamma);
+	}
+
+	void fillPfm(mappedFile* file, const float* hdr, int width, int height, std::size_t start, std::size_t count) {
+		if (!file->data()) {
+			return;
+		}
+		char* raster = file->data() + pfmHeader(width, height).size();
+		//
+		// split the range in pieces of rows, since every row lands
+		// at its flipped position
+		//
+		for (std::size_t i = start, end = start + count; i < end; ) {
+			std::size_t y = i / width;
+			std::size_t x = i % width;
+			std::size_t n = std::min(end - i, (std::size_t)width - x);
+			std::size_t offset = ((height - 1 - y) * width + x) * 3 * sizeof(float);
+			std::memcpy(raster + offset, hdr + i * 3, n * 3 * sizeof(float));
+			i += n;
+		}
+	}
+
+	void fillRaw(mappedFile* file, const float* hdr, std::size_t start, std::size_t count) {
+		if (!file->data()) {
+			return;
+		}
+		std::memcpy(file->data() + start * 3 * sizeof(float), hdr + start * 3, count * 3 * sizeof(float));
+	}
+}
@@ -0,0 +1,77 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace image {
+	// converts a linear rgb float buffer into 8-bit rgb.
+	// 'count' is the number of pixels. 'exposure' is given in
+	// stops and 'gamma' is the encoding exponent
+	extern void tonemap(const float* hdr, std::uint8_t* ldr, std::size_t count, double exposure, double gamma);
+
+	// converts a single channel buffer of positive values into a
+	// logarithmic 8-bit rgb heat map, from black at the lowest
+	// value through red and yellow to white at the highest one
+	extern void heatmap(const float* values, std::uint8_t* ldr, std::size_t count);
+
+	// 8-bit writers
+	extern bool writePng(std::string path, const std::uint8_t* ldr, int width, int height);
+	extern bool writePpm(std::string path, const std::uint8_t* ldr, int width, int height);
+
+	// linear float writers. pfm is the portable float map
+	// format. raw is headerless, top to bottom, rgb float32
+	extern bool writePfm(std::string path, const float* hdr, int width, int height);
+
+	// same as above, for buffers of one or three 'channels'. single
+	// channel buffers are stored as greyscale pfm files
+	extern bool writePfm(std::string path, const float* data, int width, int height, int channels);
+	extern bool writeRaw(std::string path, const float* hdr, int width, int height);
+
+	// read a portable float map back into a top to bottom
+	// rgb float buffer
+	extern bool readPfm(std::string path, std::vector<float>& hdr, int& width, int& height);
+
+	// headerless float buffers of a known size, in the machine's
+	// byte order. used for intermediate buffers
+	extern bool writeFloats(std::string path, const float* data, std::size_t count);
+	extern bool readFloats(std::string path, float* data, std::size_t count);
+
+	// headers of the binary ppm and pfm formats
+	extern std::string ppmHeader(int width, int height);
+	extern std::string pfmHeader(int width, int height);
+	extern std::string pfmHeader(int width, int height, int channels);
+
+	// output file mapped into memory and sized in advance, so that
+	// several threads can fill different parts of it at once
+	class mappedFile {
+		private:
+			char* bytes;
+			std::size_t size;
+#ifdef _WIN32
+			std::string path;
+			std::vector<char> buffer;
+#endif
+
+		public:
+			mappedFile(std::string path, std::size_t size);
+			~mappedFile();
+
+			// null if the file couldn't be created
+			char* data();
+	};
+
+	// tonemap a range of pixels straight into a binary ppm file.
+	// 'start' and 'count' are given in pixels
+	extern void fillPpm(mappedFile* file, const float* hdr, int width, int height, std::size_t start, std::size_t count, double exposure, double gamma);
+
+	// copy a range of pixels into a pfm file, whose rows go from
+	// bottom to top, or into a headerless raw float file
+	extern void fillPfm(mappedFile* file, const float* hdr, int width, int height, std::size_t start, std::size_t count);
+	extern void fillRaw(mappedFile* file, const float* hdr, std::size_t start, std::size_t count);
+}
@@ -0,0 +1,125 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#include "irradiance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+const int LEVELS = 24;
+
+irradianceCache::irradianceCache(double accuracy, double cellSize) {
+	this->accuracy = accuracy;
+	this->cellSize = cellSize;
+	levels.resize(LEVELS);
+	lowest = LEVELS;
+	highest = -1;
+}
+
+std::uint64_t irradianceCache::key(math::vec3 p, int level) const {
+	double size = cellSize * (double)(1 << level);
+	std::uint64_t x = (std::uint64_t)(std::int64_t)std::floor(p.x / size) & 0x1fffff;
+	std::uint64_t y = (std::uint64_t)(std::int64_t)std::floor(p.y / size) & 0x1fffff;
+	std::uint64_t z = (std::uint64_t)(std::int64_t)std::floor(p.z / size) & 0x1fffff;
+	return x | (y << 21) | (z << 42);
+}
+
+bool irradianceCache::lookup(math::vec3 position, math::vec3 normal, double& value) const {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	double total = 0.0;
+	double weights = 0.0;
+	for (int level = lowest; level <= highest; ++level) {
+		auto& cells = levels[level];
+		if (cells.empty()) {
+			continue;
+		}
+
+		//
+		// cells are at least twice as big as the reach of their
+		// records, so only the cell holding the point and its
+		// closest neighbours along every axis can reach it
+		//
+		double size = cellSize * (double)(1 << level);
+		math::vec3 side(
+			position.x - std::floor(position.x / size) * size < size * 0.5 ? -size : size,
+			position.y - std::floor(position.y / size) * size < size * 0.5 ? -size : size,
+			position.z - std::floor(position.z / size) * size < size * 0.5 ? -size : size
+		);
+		for (int dz = 0; dz <= 1; ++dz) {
+			for (int dy = 0; dy <= 1; ++dy) {
+				for (int dx = 0; dx <= 1; ++dx) {
+					auto cell = cells.find(key(position + math::vec3(dx * side.x, dy * side.y, dz * side.z), level));
+					if (cell == cells.end()) {
+						continue;
+					}
+					for (int index : cell->second) {
+						const record& r = records[index];
+						math::vec3 offset = position - r.position;
+						double reach = accuracy * r.radius;
+						if (math::dot(offset, offset) >= reach * reach) {
+							continue;
+						}
+
+						//
+						// the error estimate grows with the distance
+						// relative to the record's radius and with the
+						// difference between normals
+						//
+						double error = math::length(offset) / r.radius + std::sqrt(std::max(0.0, 1.0 - math::dot(normal, r.normal)));
+						if (error >= accuracy) {
+							continue;
+						}
+
+						//
+						// points in front of the record might see
+						// geometry it doesn't
+						//
+						if (math::dot(offset, (normal + r.normal) * 0.5) < -0.05 * r.radius) {
+							continue;
+						}
+
+						double weight = 1.0 / std::max(error, 1e-6) - 1.0 / accuracy;
+						double extrapolated = r.value + math::dot(math::cross(r.normal, normal), r.rotation) + math::dot(offset, r.translation);
+						total += weight * std::min(1.0, std::max(0.0, extrapolated));
+						weights += weight;
+					}
+				}
+			}
+		}
+	}
+	if (weights <= 0.0) {
+		return false;
+	}
+	value = total / weights;
+	return true;
+}
+
+void irradianceCache::insert(const record& r) {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	int level = 0;
+	while (level + 1 < LEVELS && cellSize * (double)(1 << level) < 2.0 * accuracy * r.radius) {
+		++level;
+	}
+	lowest = std::min(lowest, level);
+	highest = std::max(highest, level);
+	records.push_back(r);
+	levels[level][key(r.position, level)].push_back((int)records.size() - 1);
+}
+
+void irradianceCache::clear() {
+	std::unique_lock<std::shared_mutex> guard(lock);
+	records.clear();
+	for (auto& cells : levels) {
+		cells.clear();
+	}
+	lowest = LEVELS;
+	highest = -1;
+}
+
+std::size_t irradianceCache::size() const {
+	std::shared_lock<std::shared_mutex> guard(lock);
+	return records.size();
+}
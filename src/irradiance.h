@@ -0,0 +1,70 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#pragma once
+
+#include "math.h"
+
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// irradiance cache. sky light changes slowly over most surfaces, so
+// it's estimated at sparse points and interpolated everywhere else.
+// every record is valid up to a distance proportional to how far
+// the surrounding geometry is, and it's extrapolated with its
+// rotational and translational gradients. explained in detail by
+// greg ward and paul heckbert:
+// https://www.graphics.cornell.edu/~bjw/IrradianceGradients.pdf
+// lookups and insertions can be done by several threads at once
+class irradianceCache {
+	public:
+		struct record {
+			math::vec3 position;
+			math::vec3 normal;
+			// sky visibility, from 0 to 1
+			double value;
+			// harmonic mean distance to the surrounding geometry
+			double radius;
+			math::vec3 rotation;
+			math::vec3 translation;
+		};
+
+	private:
+		// records are found through a hash grid per level. cells
+		// of a level are twice as big as the previous level's, and
+		// every record is stored at the cell holding its position
+		// at the first level whose cells are twice its reach.
+		// 'lowest' and 'highest' are the levels holding records
+		double accuracy;
+		double cellSize;
+		std::deque<record> records;
+		std::vector<std::unordered_map<std::uint64_t, std::vector<int>>> levels;
+		int lowest;
+		int highest;
+		mutable std::shared_mutex lock;
+
+		std::uint64_t key(math::vec3 p, int level) const;
+
+	public:
+		// 'accuracy' is the largest error allowed, where smaller
+		// values use more records. 'cellSize' is the size of the
+		// cells of the first level
+		irradianceCache(double accuracy, double cellSize);
+
+		// weighted average of the records around a point. returns
+		// false if none of them reaches it
+		bool lookup(math::vec3 position, math::vec3 normal, double& value) const;
+
+		void insert(const record& r);
+
+		// remove every record
+		void clear();
+
+		// number of records
+		std::size_t size() const;
+};
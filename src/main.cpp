@@ -3,220 +3,1423 @@
  * Copyright (c) 2020 Pablo Peñarroja
  */
 
-// png lib by Nayuki (https://www.nayuki.io/page/tiny-png-output)
-#include "TinyPngOut.hpp"
-
 #include "config.h"
+#include "counters.h"
+#include "cpu.h"
 #include "fractal.h"
 #include "gui.h"
+#include "image.h"
 #include "math.h"
 #include "seed.h"
 #include "renderer.h"
+#include "server.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <sstream>
 #include <thread>
 
-// this function wil be instantiated in multiple threads at runtime. it iterates
-// through a specified range in a 2d matrix and renders every pixel in the range.
-// then it stores the pixel value at the "image" 2d matrix
-void renderRange(int startRow, int endRow, int startCol, int endCol, int width, int height, int chunk, renderer* r, std::vector<std::vector<math::vec3>>* image) {
-	for (int y = startRow, x = startCol; y < height && (y < endRow || chunk > 0); ++y) {
-		for (; x < width && (x < endCol || chunk > 0); ++x) {
-			(*image)[y][x] = r->render((double)height - ((double)y + 0.5), (double)x + 0.5);
-			--chunk;
-		}
-		x = 0;
-	}
+// auxiliary output buffers, filled along with the image. normal and
+// albedo are rgb and the rest have one value per pixel
+struct auxiliary {
+	std::vector<float> depth;
+	std::vector<float> normal;
+	std::vector<float> albedo;
+	std::vector<float> steps;
+	std::vector<float> mask;
+};
+
+// store a pixel's auxiliary outputs
+void storeAuxiliary(auxiliary* aux, std::size_t index, const renderer::aov& a) {
+	aux->depth[index] = (float)a.depth;
+	aux->normal[index * 3 + 0] = (float)a.normal.x;
+	aux->normal[index * 3 + 1] = (float)a.normal.y;
+	aux->normal[index * 3 + 2] = (float)a.normal.z;
+	aux->albedo[index * 3 + 0] = (float)a.albedo.x;
+	aux->albedo[index * 3 + 1] = (float)a.albedo.y;
+	aux->albedo[index * 3 + 2] = (float)a.albedo.z;
+	aux->steps[index] = (float)a.steps;
+	aux->mask[index] = (float)a.mask;
 }
 
-int main(int argc, char* argv[]) {
-	// base coordinates
-	double y = 0.5, x = 0.5;
+// add a rendered pixel to the progress of the calling thread
+void publish(gui::progress* counter, long long rays, long long evaluations) {
+	// only this thread writes to its counter, so there's no need
+	// for atomic read-modify-write operations
+	counter->pixels.store(counter->pixels.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	counter->rays.store(counter->rays.load(std::memory_order_relaxed) + rays, std::memory_order_relaxed);
+	counter->evaluations.store(counter->evaluations.load(std::memory_order_relaxed) + evaluations, std::memory_order_relaxed);
+}
 
-	// init gui
-	gui::setup();
+// renders a single pixel and stores its linear value at the "image"
+// rgb float buffer, the number of distance estimations it took at
+// the "steps" buffer and its auxiliary outputs at "aux", if it
+// isn't null. then it publishes the thread's progress
+void renderPixel(int y, int x, int width, int height, renderer* r, float* image, float* steps, auxiliary* aux, gui::progress* counter) {
+	long long evaluations = fractal::evaluations;
+	long long rays = fractal::rays;
+	std::size_t index = (std::size_t)y * width + x;
+	renderer::aov a;
+	math::vec3 pixel = r->render((double)height - ((double)y + 0.5), (double)x + 0.5, aux ? &a : nullptr);
+	if (aux) {
+		storeAuxiliary(aux, index, a);
+	}
+	float* out = image + index * 3;
+	out[0] = (float)pixel.x;
+	out[1] = (float)pixel.y;
+	out[2] = (float)pixel.z;
+	steps[index] = (float)(fractal::evaluations - evaluations);
+	publish(counter, fractal::rays - rays, fractal::evaluations - evaluations);
+}
 
-	// get config info
-	int width = config::getInt("width");
-	int height = config::getInt("height");
-	int threadCount = config::getInt("threads");
+// memory mapped output files. every render thread fills them with
+// its own chunk as soon as it's done, so there's nothing left to
+// convert once rendering ends. unused outputs are null
+struct outputs {
+	image::mappedFile* ppm;
+	image::mappedFile* pfm;
+	image::mappedFile* raw;
+	double exposure;
+	double gamma;
+};
 
-	// pointer to seed object and parsing user input
-	seed* s;
-	if (argc > 2) {
-		std::cout << "[-] The only permissible argument is a seed file's location.\n\n";
-		return 0;
-	} else if (argc == 2) {
-		std::ifstream seedFile(argv[1]);
-		if (!seedFile.good()) {
-			std::cout << "[-] Couldn't find specified seed file.\n\n";
-			return 0;
+// write a range of rendered pixels to every output
+void writeChunk(outputs* out, const float* image, int width, int height, std::size_t start, std::size_t count) {
+	if (!out) {
+		return;
+	}
+	trace::scope scope("fill outputs");
+	counters::scope counted(counters::ENCODE);
+	if (out->ppm) {
+		image::fillPpm(out->ppm, image, width, height, start, count, out->exposure, out->gamma);
+	}
+	if (out->pfm) {
+		image::fillPfm(out->pfm, image, width, height, start, count);
+	}
+	if (out->raw) {
+		image::fillRaw(out->raw, image, start, count);
+	}
+}
+
+// this function wil be instantiated in multiple threads at runtime. it renders
+// 'count' pixels starting at pixel 'start', counting row by row from the top
+// left. if 'core' isn't negative, the thread is pinned to that logical cpu first
+void renderRange(std::size_t start, std::size_t count, int width, int height, int core, renderer* r, float* image, float* steps, auxiliary* aux, gui::progress* counter, outputs* out) {
+	if (core >= 0) {
+		cpu::pin(core);
+	}
+	{
+		trace::scope scope("chunk", (long long)start);
+		counters::scope counted(counters::RENDER);
+		for (std::size_t i = start; i < start + count; ++i) {
+			renderPixel((int)(i / width), (int)(i % width), width, height, r, image, steps, aux, counter);
 		}
-		std::string seedData;
-		std::getline(seedFile, seedData);
-		s = new seed(seedData);
-		if (!s->seedParsingSuccessful) {
-			std::cout << "[-] Seed not valid.\n\n";
-			delete s;
-			return 0;
+	}
+	writeChunk(out, image, width, height, start, count);
+}
+
+// stores the cost of every pixel as a logarithmic heat map, and a
+// histogram of it with power of two buckets
+void writeStepStats(const float* steps, int width, int height, std::string fileCountStr) {
+	trace::scope scope("step map");
+	counters::scope counted(counters::ENCODE);
+	std::vector<std::uint8_t> ldr((std::size_t)width * height * 3);
+	image::heatmap(steps, ldr.data(), (std::size_t)width * height);
+	if (image::writePng("steps" + fileCountStr + ".png", ldr.data(), width, height)) {
+		std::cout << "[+] Successfully stored step map to 'steps" << fileCountStr << ".png'.\n";
+	}
+
+	std::vector<float> sorted(steps, steps + (std::size_t)width * height);
+	std::sort(sorted.begin(), sorted.end());
+	std::vector<long long> buckets(64, 0);
+	double total = 0.0;
+	for (auto& v : sorted) {
+		int bucket = v < 1.0f ? 0 : 1 + (int)std::log2(v);
+		++buckets[bucket];
+		total += v;
+	}
+
+	std::ofstream out("steps" + fileCountStr + ".txt");
+	out << "# distance estimations per pixel\n";
+	out << "mean " << total / sorted.size() << '\n';
+	out << "p50 " << sorted[sorted.size() / 2] << '\n';
+	out << "p99 " << sorted[sorted.size() * 99 / 100] << '\n';
+	out << "max " << sorted.back() << '\n';
+	out << "# from to pixels\n";
+	for (int i = 0; i < 64; ++i) {
+		if (buckets[i]) {
+			out << (i ? 1LL << (i - 1) : 0) << ' ' << (1LL << i) << ' ' << buckets[i] << '\n';
 		}
-		std::cout << "[+] Successfully read seed from '" << argv[1] << "'.\n";
-	} else {
-		s = new seed();
 	}
+	std::cout << "[+] Successfully stored step histogram to 'steps" << fileCountStr << ".txt'.\n";
+}
 
-	// pointer to fractal object
-	fractal* f = new fractal(s);
+// wait for every thread of a list to finish
+void joinAll(std::vector<std::thread>& threads) {
+	trace::scope scope("join wait");
+	for (auto& thread : threads) {
+		thread.join();
+	}
+}
 
-	// pointer to renderer object
-	renderer* r = new renderer(width, height, s, f);
+// shades every 'threadCount'th row of the image from the paths
+// recorded by the renderer, starting at row 'thread'
+void shadeRows(int thread, int threadCount, int width, int height, renderer* r, float* image) {
+	trace::scope scope("shade rows", thread);
+	counters::scope counted(counters::RENDER);
+	for (int y = thread; y < height; y += threadCount) {
+		for (int x = 0; x < width; ++x) {
+			math::vec3 pixel = r->shade((double)height - ((double)y + 0.5), (double)x + 0.5);
+			float* out = image + ((std::size_t)y * width + x) * 3;
+			out[0] = (float)pixel.x;
+			out[1] = (float)pixel.y;
+			out[2] = (float)pixel.z;
+		}
+	}
+}
 
-	// pointer to 2d matrix of pixels. it'll be accessible
-	// by every thread
-	std::vector<std::vector<math::vec3>>* image = new std::vector<std::vector<math::vec3>>(height, std::vector<math::vec3>(width, math::vec3()));
+// fewest rows a thread is given before the samples of every pixel
+// are split among threads too
+const int MIN_THREAD_ROWS = 32;
 
-	// thread array
-	std::vector<std::thread> threads;
+// samples of every pixel taken by a group of threads, and their sum.
+// every thread of the group renders its own rows, so they share it.
+// the buffers are left uninitialized, since every pixel is written
+// once by the thread rendering it, which is also the first to touch
+// its memory and so places it on its own node
+struct sampleGroup {
+	int first;
+	int count;
+	std::unique_ptr<float[]> sum;
+	std::unique_ptr<float[]> steps;
+};
 
-	// thread constants
-	int chunk = width * height / threadCount;
-	int lastY = 0;
-	int lastX = 0;
+// render every 'bands'th row of a sample group, starting at 'band'.
+// if 'core' isn't negative, the thread is pinned to that logical cpu
+void renderGroupRows(int band, int bands, int width, int height, int core, renderer* r, sampleGroup* group, gui::progress* counter) {
+	if (core >= 0) {
+		cpu::pin(core);
+	}
+	trace::scope scope("sample rows", group->first);
+	counters::scope counted(counters::RENDER);
+	for (int y = band; y < height; y += bands) {
+		for (int x = 0; x < width; ++x) {
+			long long evaluations = fractal::evaluations;
+			long long rays = fractal::rays;
+			math::vec3 pixel = r->render((double)height - ((double)y + 0.5), (double)x + 0.5, group->count, group->first);
+			std::size_t index = (std::size_t)y * width + x;
+			group->sum[index * 3 + 0] = (float)(pixel.x * group->count);
+			group->sum[index * 3 + 1] = (float)(pixel.y * group->count);
+			group->sum[index * 3 + 2] = (float)(pixel.z * group->count);
+			group->steps[index] = (float)(fractal::evaluations - evaluations);
+			publish(counter, fractal::rays - rays, fractal::evaluations - evaluations);
+		}
+	}
+}
 
-	// thread assignment loop. this loop assigns to every thread
-	// the render function with the right coordinates and stores
-	// it on the thread array	
-	for (int i = 0; i < threadCount; ++i) {
-		int y = lastY;
-		int x = lastX;
-		int count = 0;
-		for (; y < height && count < chunk; ) {
-			for (; x < width && count < chunk; ) {
-				if (++count == chunk) {
-					break;
-				}
-				++x;
-			}
-			if (count < chunk) {
-				x = 0;
-				++y;
+// add up the groups of 'count' pixels from 'start', in group order,
+// and fill the outputs with them. if 'core' isn't negative, the
+// thread is pinned to that logical cpu
+void reduceGroups(std::size_t start, std::size_t count, int width, int height, int samples, int core, const std::vector<sampleGroup>* group, float* image, float* steps, outputs* out) {
+	if (core >= 0) {
+		cpu::pin(core);
+	}
+	{
+		trace::scope scope("reduce", (long long)start);
+		for (std::size_t i = start; i < start + count; ++i) {
+			float sum[3] = { 0.0f, 0.0f, 0.0f };
+			float evaluations = 0.0f;
+			for (auto& g : *group) {
+				sum[0] += g.sum[i * 3 + 0];
+				sum[1] += g.sum[i * 3 + 1];
+				sum[2] += g.sum[i * 3 + 2];
+				evaluations += g.steps[i];
 			}
+			image[i * 3 + 0] = sum[0] / samples;
+			image[i * 3 + 1] = sum[1] / samples;
+			image[i * 3 + 2] = sum[2] / samples;
+			steps[i] = evaluations;
 		}
+	}
+	writeChunk(out, image, width, height, start, count);
+}
 
-		// skip the first chunk because that one will be rendered
-		// by the main thread later
-		if (i > 0) {
-			threads.push_back(std::thread{renderRange, lastY, y, lastX, x, width, height, chunk, r, image});
-		}
+//
+// renders the whole image with its samples split in 'groups'
+// groups. thread 't' renders the samples of group 't % groups' at
+// every row of its band, and bands interleave rows so that every
+// thread gets a share of the costly parts. once every thread is
+// done, groups are added up in order, so the image doesn't depend
+// on which thread finished first. every thread adds up and stores
+// its own share of the pixels
+//
+void renderSampleGroups(int width, int height, int threadCount, int groups, bool pin, int report, renderer* r, float* image, float* steps, outputs* out) {
+	std::vector<int> cores = cpu::coreOrder();
+	std::size_t pixels = (std::size_t)width * height;
+	int samples = r->getSamples();
+	std::vector<sampleGroup> group(groups);
+	for (int i = 0; i < groups; ++i) {
+		group[i].first = i * samples / groups;
+		group[i].count = (i + 1) * samples / groups - group[i].first;
+		group[i].sum.reset(new float[pixels * 3]);
+		group[i].steps.reset(new float[pixels]);
+	}
 
-		// advance one coordinate to set the starter coordinate
-		// for the next loop, since this coordinate has already
-		// been enqueued to be computed in the previously called
-		// thread
-		if (x + 1 == width) {
-			x = 0;
-			++y;
-		} else {
-			++x;
-		}
+	std::vector<gui::progress> counters(threadCount);
+	std::vector<std::thread> threads;
+	for (int t = 1; t < threadCount; ++t) {
+		int bands = (threadCount - t % groups + groups - 1) / groups;
+		threads.push_back(std::thread{renderGroupRows, t / groups, bands, width, height, pin ? cores[t % cores.size()] : -1, r, &group[t % groups], &counters[t]});
+	}
+	gui::finish rendered;
+	std::thread guiThread;
+	if (report >= 0) {
+		guiThread = std::thread(gui::update, &counters, (long long)pixels * groups, report, &rendered);
+	}
+	cpu::pinned pinned(pin ? cores[0] : -1);
+	renderGroupRows(0, (threadCount + groups - 1) / groups, width, height, -1, r, &group[0], &counters[0]);
+	joinAll(threads);
+	rendered.set();
+	if (report >= 0) {
+		trace::scope scope("gui wait");
+		guiThread.join();
+	}
+
+	threads.clear();
+	for (int t = 1; t < threadCount; ++t) {
+		std::size_t start = pixels * t / threadCount;
+		threads.push_back(std::thread{reduceGroups, start, pixels * (t + 1) / threadCount - start, width, height, samples, pin ? cores[t % cores.size()] : -1, &group, image, steps, out});
+	}
+	reduceGroups(0, pixels / threadCount, width, height, samples, -1, &group, image, steps, out);
+	joinAll(threads);
+}
 
-		// save starter coordinates
-		lastY = y;
-		lastX = x;
+// renders the whole image. it's split in one contiguous chunk per
+// thread, the first of which is rendered by the calling thread.
+// 'pin' pins every thread to its own logical cpu, one per physical
+// core first. 'report' is the progress format passed to gui::update,
+// or -1 to report nothing. 'aux' are the auxiliary outputs and 'out'
+// the outputs filled by every thread, either of which can be null.
+// images with fewer than MIN_THREAD_ROWS rows per thread are split
+// by samples too, unless they have auxiliary outputs or their paths
+// are recorded, which need every sample of a pixel at once
+void renderImage(int width, int height, int threadCount, bool pin, int report, renderer* r, float* image, float* steps, auxiliary* aux, outputs* out) {
+	r->clearCache();
+	if (!aux && r->paths.empty() && height < threadCount * MIN_THREAD_ROWS) {
+		int groups = std::min(std::min(r->getSamples(), threadCount), (threadCount * MIN_THREAD_ROWS + height - 1) / height);
+		if (groups > 1) {
+			renderSampleGroups(width, height, threadCount, groups, pin, report, r, image, steps, out);
+			return;
+		}
 	}
 
-	// fill the remaining image portion which is smaller
-	// than one chunk in case there's any
-	if ((width * height) % threadCount != 0) {
-		threads.push_back(std::thread{renderRange, lastY, height, lastX, width, width, height, chunk, r, image});
+	std::vector<int> cores = cpu::coreOrder();
+
+	//
+	// thread assignment. the image is split in one contiguous chunk
+	// of pixels per thread, whose sizes differ by one pixel at most,
+	// so that every pixel is rendered. images with fewer pixels than
+	// threads get one pixel per thread
+	//
+	std::size_t pixels = (std::size_t)width * height;
+	threadCount = (int)std::max<std::size_t>(1, std::min<std::size_t>(threadCount, pixels));
+	std::vector<gui::progress> counters(threadCount);
+	std::vector<std::thread> threads;
+
+	// skip the first chunk because that one will be rendered by the
+	// main thread later
+	for (int i = 1; i < threadCount; ++i) {
+		std::size_t start = pixels * i / threadCount;
+		threads.push_back(std::thread{renderRange, start, pixels * (i + 1) / threadCount - start, width, height, pin ? cores[i % cores.size()] : -1, r, image, steps, aux, &counters[i], out});
 	}
 
 	// render the first chunk in the main application thread
-	// so that it can update the gui progress bar
+	// so that it can update the gui progress bar. it's pinned
+	// only while rendering, after the gui thread is created
+	gui::finish rendered;
+	std::thread guiThread;
+	if (report >= 0) {
+		guiThread = std::thread(gui::update, &counters, (long long)pixels, report, &rendered);
+	}
+	cpu::pinned pinned(pin ? cores[0] : -1);
+	renderRange(0, pixels / threadCount, width, height, -1, r, image, steps, aux, &counters[0], out);
+
+	// wait for rendering threads to finish
+	joinAll(threads);
+	rendered.set();
+	
+	// wait for graphical user interface thread
+	if (report >= 0) {
+		trace::scope scope("gui wait");
+		guiThread.join();
+	}
+
+}
+
+// renders one preview stage, which has one pixel for every
+// 'scale' x 'scale' block of the final image and a single sample.
+// every pixel is sampled at the top left corner of its block,
+// so the even pixels of a stage land exactly on the pixels of
+// the previous, coarser stage and are copied instead of rendered
+void renderPreviewRows(int thread, int threadCount, int width, int height, int scale, renderer* r, const std::vector<float>* coarse, std::vector<float>* stage) {
+	int stageWidth = (width + scale - 1) / scale;
+	int stageHeight = (height + scale - 1) / scale;
+	int coarseWidth = (stageWidth + 1) / 2;
+	trace::scope scope("preview rows", scale);
+	counters::scope counted(counters::RENDER);
+	for (int y = thread; y < stageHeight; y += threadCount) {
+		for (int x = 0; x < stageWidth; ++x) {
+			float* out = stage->data() + ((std::size_t)y * stageWidth + x) * 3;
+			if (coarse && y % 2 == 0 && x % 2 == 0) {
+				const float* in = coarse->data() + ((std::size_t)(y / 2) * coarseWidth + x / 2) * 3;
+				out[0] = in[0];
+				out[1] = in[1];
+				out[2] = in[2];
+				continue;
+			}
+			math::vec3 pixel = r->render((double)height - ((double)y * scale + 0.5), (double)x * scale + 0.5, 1);
+			out[0] = (float)pixel.x;
+			out[1] = (float)pixel.y;
+			out[2] = (float)pixel.z;
+		}
+	}
+}
+
+// side of the tiles of a deadline bounded render, and scale of the
+// coarse image rendered before its first pass
+const int TILE_SIZE = 16;
+const int COARSE_SCALE = 4;
+
+// deadline bounded render shared by the threads of a pass. 'sum'
+// holds the sum of every sample, 'squares' the sum of every
+// sample's squared luminance, and 'samples' the samples taken by
+// every tile
+struct progressive {
+	int width;
+	int height;
+	int tilesX;
+	std::vector<int> order;
+	std::atomic<int> next;
+	std::vector<float> sum;
+	std::vector<float> squares;
+	std::vector<int> samples;
+	std::vector<float> coarse;
+	float* steps;
+	auxiliary* aux;
+	std::chrono::steady_clock::time_point deadline;
+};
+
+//
+// one pass of a deadline bounded render. tiles are taken in order
+// and every one of their pixels gets one more sample, until every
+// tile is done or the deadline passes
+//
+void renderPass(progressive* p, renderer* r) {
+	for (int i = p->next.fetch_add(1); i < (int)p->order.size(); i = p->next.fetch_add(1)) {
+		if (std::chrono::steady_clock::now() >= p->deadline) {
+			return;
+		}
+		int tile = p->order[i];
+		trace::scope scope("tile", tile);
+		counters::scope counted(counters::RENDER);
+		int x0 = tile % p->tilesX * TILE_SIZE;
+		int y0 = tile / p->tilesX * TILE_SIZE;
+		for (int y = y0; y < std::min(y0 + TILE_SIZE, p->height); ++y) {
+			for (int x = x0; x < std::min(x0 + TILE_SIZE, p->width); ++x) {
+				std::size_t index = (std::size_t)y * p->width + x;
+				long long evaluations = fractal::evaluations;
+				renderer::aov a;
+				bool first = p->aux && p->samples[tile] == 0;
+				math::vec3 pixel = r->render((double)p->height - ((double)y + 0.5), (double)x + 0.5, 1, p->samples[tile], first ? &a : nullptr);
+				if (first) {
+					storeAuxiliary(p->aux, index, a);
+				}
+				p->sum[index * 3 + 0] += (float)pixel.x;
+				p->sum[index * 3 + 1] += (float)pixel.y;
+				p->sum[index * 3 + 2] += (float)pixel.z;
+				double l = 0.2126 * pixel.x + 0.7152 * pixel.y + 0.0722 * pixel.z;
+				p->squares[index] += (float)(l * l);
+				p->steps[index] += (float)(fractal::evaluations - evaluations);
+			}
+		}
+		++p->samples[tile];
+	}
+}
+
+//
+// noise of a tile. the mean standard error of its pixels'
+// luminance. a single sample has no error estimate, so the spread
+// of the pixels is used instead, and tiles without samples use the
+// spread of the coarse image
+//
+double tileNoise(progressive* p, int tile) {
+	int x0 = tile % p->tilesX * TILE_SIZE;
+	int y0 = tile / p->tilesX * TILE_SIZE;
+	int n = p->samples[tile];
+	int coarseWidth = (p->width + COARSE_SCALE - 1) / COARSE_SCALE;
+	double total = 0.0, totalSquares = 0.0, error = 0.0;
 	int count = 0;
-	std::thread guiThread(gui::update, &count, chunk);
-	for (int y = 0; y < height && count < chunk; ++y) {
-		for (int x = 0; x < width && count < chunk; ++x) {
-			(*image)[y][x] = r->render((double)height - ((double)y + 0.5f), (double)x + 0.5);
+	for (int y = y0; y < std::min(y0 + TILE_SIZE, p->height); ++y) {
+		for (int x = x0; x < std::min(x0 + TILE_SIZE, p->width); ++x) {
+			std::size_t index = (std::size_t)y * p->width + x;
+			const float* c = n ? p->sum.data() + index * 3 : p->coarse.data() + ((std::size_t)(y / COARSE_SCALE) * coarseWidth + x / COARSE_SCALE) * 3;
+			double mean = (0.2126 * c[0] + 0.7152 * c[1] + 0.0722 * c[2]) / std::max(n, 1);
+			if (n > 1) {
+				error += std::sqrt(std::max(p->squares[index] / n - mean * mean, 0.0) / n);
+			}
+			total += mean;
+			totalSquares += mean * mean;
 			++count;
 		}
 	}
+	if (n > 1) {
+		return error / count;
+	}
+	return std::sqrt(std::max(totalSquares / count - (total / count) * (total / count), 0.0));
+}
 
-	// wait for rendering threads to finish
-	for (auto& thread : threads) {
-		thread.join();
+//
+// deadline bounded render. first renders a coarse image with one
+// pixel per 4x4 block, which is never cut. then adds one sample per
+// pixel per pass, up to 'passes' passes, and stops at the first
+// tile started 'seconds' after 'start', which is when work on the
+// seed began, so the budget covers the camera search too. every pass starts with the
+// noisiest tiles, so a pass cut by the deadline spends its time
+// where it's needed the most. pixels are averaged over their own
+// sample count, and the ones without any take the coarse image.
+// auxiliary outputs are taken from every pixel's first sample, and
+// stay zero where there's none
+//
+void renderDeadline(int width, int height, int threadCount, std::chrono::steady_clock::time_point start, double seconds, int passes, renderer* r, float* image, float* steps, auxiliary* aux) {
+	r->clearCache();
+	progressive p;
+	p.width = width;
+	p.height = height;
+	p.tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles = p.tilesX * ((height + TILE_SIZE - 1) / TILE_SIZE);
+	for (int i = 0; i < tiles; ++i) {
+		p.order.push_back(i);
+	}
+	p.sum.assign((std::size_t)width * height * 3, 0.0f);
+	p.squares.assign((std::size_t)width * height, 0.0f);
+	p.samples.assign(tiles, 0);
+	p.steps = steps;
+	p.aux = aux;
+	std::fill(steps, steps + (std::size_t)width * height, 0.0f);
+	p.deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+
+	int coarseWidth = (width + COARSE_SCALE - 1) / COARSE_SCALE;
+	int coarseHeight = (height + COARSE_SCALE - 1) / COARSE_SCALE;
+	p.coarse.assign((std::size_t)coarseWidth * coarseHeight * 3, 0.0f);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < threadCount; ++i) {
+		threads.push_back(std::thread{renderPreviewRows, i, threadCount, width, height, COARSE_SCALE, r, nullptr, &p.coarse});
+	}
+	joinAll(threads);
+
+	int pass = 0;
+	for (; pass < passes && std::chrono::steady_clock::now() < p.deadline; ++pass) {
+		std::vector<double> noise(tiles);
+		for (int tile = 0; tile < tiles; ++tile) {
+			noise[tile] = tileNoise(&p, tile);
+		}
+		std::stable_sort(p.order.begin(), p.order.end(), [&](int a, int b) {
+			return noise[a] > noise[b];
+		});
+		p.next = 0;
+		threads.clear();
+		for (int i = 1; i < threadCount; ++i) {
+			threads.push_back(std::thread{renderPass, &p, r});
+		}
+		renderPass(&p, r);
+		joinAll(threads);
 	}
-	
-	// wait for graphical user interface thread
-	guiThread.join();
 
 	//
-	// define output file's path
+	// average every pixel over its tile's samples
 	//
+	int least = pass, most = 0;
+	double mean = 0.0;
+	for (int tile = 0; tile < tiles; ++tile) {
+		int x0 = tile % p.tilesX * TILE_SIZE;
+		int y0 = tile / p.tilesX * TILE_SIZE;
+		int n = p.samples[tile];
+		least = std::min(least, n);
+		most = std::max(most, n);
+		for (int y = y0; y < std::min(y0 + TILE_SIZE, height); ++y) {
+			for (int x = x0; x < std::min(x0 + TILE_SIZE, width); ++x) {
+				std::size_t index = (std::size_t)y * width + x;
+				const float* c = n ? p.sum.data() + index * 3 : p.coarse.data() + ((std::size_t)(y / COARSE_SCALE) * coarseWidth + x / COARSE_SCALE) * 3;
+				for (int k = 0; k < 3; ++k) {
+					image[index * 3 + k] = c[k] / std::max(n, 1);
+				}
+				mean += n;
+			}
+		}
+	}
+	mean /= (double)width * height;
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << std::fixed << std::setprecision(2);
+	std::cout << "[+] Rendered " << mean << " samples per pixel (" << least << " to " << most << ") in " << elapsed << "s of a " << seconds << "s budget.\n";
+}
+
+// check whether a command line argument has a given extension
+bool endsWith(std::string str, std::string suffix) {
+	return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// find the first render number which isn't used by any output
+// file in the working directory
+std::string nextFileCount() {
 	int fileCount = 0;
 	std::string fileCountStr;
 	for (bool ok = true; ok & 1; ++fileCount) {
 		fileCountStr = std::to_string(fileCount);
 		std::ifstream pngFile("render" + fileCountStr + ".png");
 		std::ifstream ppmFile("render" + fileCountStr + ".ppm");
-		ok = pngFile.good() || ppmFile.good(); 
+		std::ifstream pfmFile("render" + fileCountStr + ".pfm");
+		std::ifstream rawFile("render" + fileCountStr + ".raw");
+		std::ifstream seedFile("seed" + fileCountStr + ".txt");
+		ok = pngFile.good() || ppmFile.good() || pfmFile.good() || rawFile.good() || seedFile.good();
+	}
+	return fileCountStr;
+}
+
+// every auxiliary output buffer along with its name
+std::vector<std::pair<const char*, std::vector<float>*>> auxiliaryBuffers(auxiliary* aux) {
+	return { { "depth", &aux->depth }, { "normal", &aux->normal }, { "albedo", &aux->albedo }, { "steps", &aux->steps }, { "mask", &aux->mask } };
+}
+
+// store every auxiliary output as a pfm file next to the image.
+// 'name' is the image's path without extension
+void writeAuxiliary(auxiliary* aux, int width, int height, std::string name) {
+	trace::scope scope("auxiliary write");
+	counters::scope counted(counters::ENCODE);
+	for (const auto& buffer : auxiliaryBuffers(aux)) {
+		std::string path = name + "-" + buffer.first + ".pfm";
+		int channels = (int)(buffer.second->size() / ((std::size_t)width * height));
+		if (image::writePfm(path, buffer.second->data(), width, height, channels)) {
+			std::cout << "[+] Successfully stored " << buffer.first << " to '" << path << "'.\n";
+		} else {
+			std::cout << "[-] Couldn't store " << buffer.first << " to '" << path << "'.\n";
+		}
+	}
+}
+
+// store the timeline of the run and print its performance
+// counters, if they were recorded
+void writeProfile() {
+	counters::report();
+	if (!trace::enabled) {
+		return;
+	}
+	if (trace::write("trace.json")) {
+		std::cout << "[+] Successfully stored timeline at 'trace.json'.\n";
+	} else {
+		std::cout << "[-] Couldn't store timeline at 'trace.json'.\n";
 	}
+}
 
+// tonemap a linear image with the exposure and gamma values from
+// the config file and store it as png or ppm. 'name' is the
+// output file's path without extension
+void writeGraded(const float* image, int width, int height, std::string name) {
+	trace::scope scope("encode");
+	counters::scope counted(counters::ENCODE);
+	std::vector<std::uint8_t> ldr((std::size_t)width * height * 3);
+	image::tonemap(image, ldr.data(), (std::size_t)width * height, config::getDouble("exposure"), config::getDouble("gamma"));
+	if (config::getInt("png")) {
+		if (image::writePng(name + ".png", ldr.data(), width, height)) {
+			std::cout << "[+] Successfully stored png file to '" << name << ".png'.\n";
+		}
+	} else {
+		if (image::writePpm(name + ".ppm", ldr.data(), width, height)) {
+			std::cout << "[+] Successfully store ppm file to '" << name << ".ppm'.\n";
+		}
+	}
+}
+
+
+// true for the seed values that only change colors: the orbit trap
+// color, the light and sky colors and the sky gradient
+bool isColorValue(const std::string& name) {
+	std::string base = name.substr(1);
+	return base == "color" || base == "lightColor" || base == "skyColor" || base == "gradientTop" || base == "gradientBottom";
+}
+
+// version of the renders and paths at the cache. bump it whenever a
+// change to the renderer changes the image or the stored paths, so
+// that older entries aren't read back
+const int CACHE_VERSION = 2;
+
+//
+// key of a render at the cache. 64-bit fnv-1a hash over every seed
+// value, formula included, the cache version and every setting
+// that changes the linear image. exposure and gamma are applied
+// afterwards, so they aren't part of it. without 'colors', it's the
+// key of the render's path geometry, which the seed's colors don't
+// change
+//
+std::string cacheKey(seed* s, int width, int height, bool colors) {
+	std::string text = "version " + std::to_string(CACHE_VERSION) + '\n' + (colors ? "" : "geometry\n");
+	for (auto& value : s->values) {
+		if (!colors && isColorValue(value.first)) {
+			continue;
+		}
+		text += value.first + ' ' + seed::format(value.second) + '\n';
+	}
+	for (std::string name : { "samples", "clamp", "sampler", "shading", "fov", "bounces", "roulette", "bounds", "lod", "budget" }) {
+		text += name + ' ' + std::to_string(config::getInt(name)) + '\n';
+	}
+	text += "irradiance " + seed::format(config::getDouble("irradiance")) + '\n';
+	text += "width " + std::to_string(width) + "\nheight " + std::to_string(height) + '\n';
+	std::uint64_t hash = 14695981039346656037ULL;
+	for (unsigned char c : text) {
+		hash = (hash ^ c) * 1099511628211ULL;
+	}
+	std::ostringstream key;
+	key << std::hex << std::setw(16) << std::setfill('0') << hash;
+	return key.str();
+}
+
+// most memory the paths of a render may take to be stored. larger
+// renders are traced without storing them
+const std::size_t MAX_PATH_BYTES = (std::size_t)2 << 30;
+
+//
+// render a seed with its renderer and store the seed file, the
+// previews and every output enabled at the config file under the
+// next free render number. 'start' is when work on the seed began,
+// before its renderer was made
+//
+void renderSeed(seed* s, renderer* r, int width, int height, int threadCount, std::chrono::steady_clock::time_point start) {
 	//
-	// store seed inside new file
+	// define output file's path
+	//
+	std::string fileCountStr = nextFileCount();
+
 	//
-	std::ofstream seedOut("seed" + fileCountStr + ".txt");
-	seedOut << s->buildSeed();
+	// store seed inside new file. it's stored before rendering so
+	// that it's available as soon as the first preview is
+	//
+	{
+		trace::scope scope("seed write");
+		std::ofstream seedOut("seed" + fileCountStr + ".txt");
+		seedOut << s->buildSeed();
+		seedOut.close();
+	}
 	std::cout << "[+] Successfully stored seed at 'seed" << fileCountStr << ".txt'.\n";
 
-	if (config::getInt("png")) {
+	// pointers to linear rgb float buffer and per pixel cost
+	// buffer. they'll be accessible by every thread. they aren't
+	// initialized, so every page is first touched by the thread
+	// rendering it and lands in that thread's memory node
+	std::size_t pixels = (std::size_t)width * height;
+	float* image = new float[pixels * 3];
+	float* steps = new float[pixels];
+
+	// auxiliary outputs, if they're stored
+	auxiliary* aux = nullptr;
+	if (config::getInt("aov")) {
+		aux = new auxiliary();
+		aux->depth.assign(pixels, 0.0f);
+		aux->normal.assign(pixels * 3, 0.0f);
+		aux->albedo.assign(pixels * 3, 0.0f);
+		aux->steps.assign(pixels, 0.0f);
+		aux->mask.assign(pixels, 0.0f);
+	}
+
+	//
+	// render cache. renders are stored by a hash of their seed and
+	// settings, and a render found there is read back instead of
+	// rendered again. auxiliary outputs are stored along with the
+	// image, and renders that store them only read back renders
+	// that have them
+	//
+	bool cache = config::getInt("cache");
+	std::string cachePath = "cache/" + (cache ? cacheKey(s, width, height, true) : std::string());
+	bool cached = false;
+	if (cache) {
+		trace::scope scope("cache read");
+		std::vector<float> hdr;
+		int cachedWidth, cachedHeight;
+		bool found = image::readPfm(cachePath + ".pfm", hdr, cachedWidth, cachedHeight) && cachedWidth == width && cachedHeight == height && image::readFloats(cachePath + ".steps", steps, pixels);
+		if (found && aux) {
+			for (const auto& buffer : auxiliaryBuffers(aux)) {
+				found = found && image::readFloats(cachePath + "-" + buffer.first + ".aov", buffer.second->data(), buffer.second->size());
+			}
+		}
+		if (found) {
+			std::copy(hdr.begin(), hdr.end(), image);
+			cached = true;
+			std::cout << "[+] Found render at '" << cachePath << ".pfm'.\n";
+		}
+	}
+
+	//
+	// path geometry. the paths of every sample are stored at the
+	// 'cache' directory by a hash that leaves the seed's colors out,
+	// so a render that only changes colors is shaded from them
+	// instead of traced again. shading doesn't give auxiliary outputs,
+	// so renders with them skip it, and deadline bounded renders
+	// don't take every sample, so they skip it too
+	//
+	double deadline = config::getDouble("deadline");
+	bool geometry = config::getInt("geometry") && !aux && !cached && deadline <= 0.0;
+	if (geometry && r->recordBytes() > MAX_PATH_BYTES) {
+		geometry = false;
+		std::cout << "[-] Paths would take " << (r->recordBytes() >> 20) << " MB, more than the " << (MAX_PATH_BYTES >> 20) << " MB allowed. They won't be stored.\n";
+	}
+	std::string geometryPath = "cache/" + (geometry ? cacheKey(s, width, height, false) : std::string());
+	std::size_t pathFloats = 0;
+	bool reshade = false;
+	if (geometry) {
+		trace::scope scope("geometry read");
+		if (r->record()) {
+			std::cout << "[+] Russian roulette is turned off while paths are stored.\n";
+		}
+		pathFloats = r->paths.size() * sizeof(renderer::bounce) / sizeof(float);
+		if (image::readFloats(geometryPath + ".paths", (float*)r->paths.data(), pathFloats) && image::readFloats(geometryPath + ".steps", steps, pixels)) {
+			reshade = true;
+			std::cout << "[+] Found paths at '" << geometryPath << ".paths'.\n";
+		}
+	}
+
+	//
+	// progressive preview. renders the image at 1/8, 1/4 and 1/2
+	// of its resolution with one sample, storing every stage as
+	// soon as it's done. deadline bounded renders skip it, since
+	// it would take from their budget
+	//
+	int preview = cached || reshade || deadline > 0.0 ? 0 : config::getInt("preview");
+	if (preview) {
+		std::vector<float>* coarse = nullptr;
+		for (int scale = 8; scale > 1; scale /= 2) {
+			int stageWidth = (width + scale - 1) / scale;
+			int stageHeight = (height + scale - 1) / scale;
+			std::vector<float>* stage = new std::vector<float>((std::size_t)stageWidth * stageHeight * 3, 0.0f);
+			r->clearCache();
+			std::vector<std::thread> previewThreads;
+			for (int i = 0; i < threadCount; ++i) {
+				previewThreads.push_back(std::thread{renderPreviewRows, i, threadCount, width, height, scale, r, coarse, stage});
+			}
+			joinAll(previewThreads);
+			writeGraded(stage->data(), stageWidth, stageHeight, "preview" + fileCountStr + "-" + std::to_string(scale));
+			delete coarse;
+			coarse = stage;
+		}
+		delete coarse;
+	}
+
+	// preview only mode
+	if (preview == 2) {
+		std::cout << "\n";
+		delete[] image;
+		delete[] steps;
+		delete aux;
+		return;
+	}
+
+	//
+	// create the outputs filled by the render threads. the linear
+	// image is stored so that it can be re-graded later without
+	// rendering it again. png files are encoded sequentially, so
+	// they're written once rendering ends
+	//
+	int hdr = config::getInt("hdr");
+	int png = config::getInt("png");
+	outputs out = { nullptr, nullptr, nullptr, config::getDouble("exposure"), config::getDouble("gamma") };
+	if (!png) {
+		std::string header = image::ppmHeader(width, height);
+		out.ppm = new image::mappedFile("render" + fileCountStr + ".ppm", header.size() + pixels * 3);
+		if (out.ppm->data()) {
+			std::copy(header.begin(), header.end(), out.ppm->data());
+		}
+	}
+	if (hdr == 1) {
+		std::string header = image::pfmHeader(width, height);
+		out.pfm = new image::mappedFile("render" + fileCountStr + ".pfm", header.size() + pixels * 3 * sizeof(float));
+		if (out.pfm->data()) {
+			std::copy(header.begin(), header.end(), out.pfm->data());
+		}
+	} else if (hdr == 2) {
+		out.raw = new image::mappedFile("render" + fileCountStr + ".raw", pixels * 3 * sizeof(float));
+	}
+
+	if (cached) {
+		writeChunk(&out, image, width, height, 0, pixels);
+	} else if (reshade) {
+		std::vector<std::thread> threads;
+		for (int i = 1; i < threadCount; ++i) {
+			threads.push_back(std::thread{shadeRows, i, threadCount, width, height, r, image});
+		}
+		shadeRows(0, threadCount, width, height, r, image);
+		joinAll(threads);
+		writeChunk(&out, image, width, height, 0, pixels);
+	} else if (deadline > 0.0) {
+		// deadline bounded renders vary, so they aren't cached
+		renderDeadline(width, height, threadCount, start, deadline, config::getInt("samples"), r, image, steps, aux);
+		writeChunk(&out, image, width, height, 0, pixels);
+	} else {
+		renderImage(width, height, threadCount, config::getInt("pin"), config::getInt("progress"), r, image, steps, aux, &out);
+		if (cache) {
+			trace::scope scope("cache write");
+			std::error_code error;
+			std::filesystem::create_directories("cache", error);
+			bool stored = image::writePfm(cachePath + ".pfm", image, width, height) && image::writeFloats(cachePath + ".steps", steps, pixels);
+			if (stored && aux) {
+				for (const auto& buffer : auxiliaryBuffers(aux)) {
+					stored = stored && image::writeFloats(cachePath + "-" + buffer.first + ".aov", buffer.second->data(), buffer.second->size());
+				}
+			}
+			if (stored) {
+				std::cout << "[+] Successfully stored render at '" << cachePath << ".pfm'.\n";
+			}
+		}
+		if (geometry) {
+			trace::scope scope("geometry write");
+			std::error_code error;
+			std::filesystem::create_directories("cache", error);
+			if (image::writeFloats(geometryPath + ".paths", (float*)r->paths.data(), pathFloats) && image::writeFloats(geometryPath + ".steps", steps, pixels)) {
+				std::cout << "[+] Successfully stored paths at '" << geometryPath << ".paths'.\n";
+			}
+		}
+	}
+
+	//
+	// close the outputs filled by the render threads
+	//
+	{
+		trace::scope scope("close outputs");
+		if (out.pfm) {
+			std::cout << (out.pfm->data() ? "[+] Successfully stored" : "[-] Couldn't store") << " pfm file to 'render" << fileCountStr << ".pfm'.\n";
+			delete out.pfm;
+		}
+		if (out.raw) {
+			std::cout << (out.raw->data() ? "[+] Successfully stored" : "[-] Couldn't store") << " raw file to 'render" << fileCountStr << ".raw'.\n";
+			delete out.raw;
+		}
+		if (out.ppm) {
+			std::cout << (out.ppm->data() ? "[+] Successfully stored" : "[-] Couldn't store") << " ppm file to 'render" << fileCountStr << ".ppm'.\n";
+			delete out.ppm;
+		}
+	}
+
+	//
+	// tonemap and store the png image
+	//
+	if (png) {
+		writeGraded(image, width, height, "render" + fileCountStr);
+	}
+
+	//
+	// store the auxiliary outputs
+	//
+	if (aux) {
+		writeAuxiliary(aux, width, height, "render" + fileCountStr);
+	}
+
+	//
+	// store per pixel cost
+	//
+	if (config::getInt("stepmap")) {
+		writeStepStats(steps, width, height, fileCountStr);
+	}
+	std::cout << "\n";
+
+	delete[] image;
+	delete[] steps;
+	delete aux;
+}
+
+// random seed drawn by the exploration mode and the scores of its
+// thumbnail
+struct candidate {
+	std::string seed;
+	double coverage;
+	double contrast;
+	double edges;
+	double score;
+};
+
+//
+// render thumbnails until every candidate is scored. every thread
+// takes whole candidates, so thumbnails are rendered in parallel
+// without sharing any renderer. a thumbnail is scored by:
+// - coverage: fraction of pixels hitting the fractal. frames
+//   where the fractal is tiny or missing score lower
+// - contrast: standard deviation of the gamma encoded luminance,
+//   averaged over blocks of 4x4 pixels so that single sample noise
+//   doesn't count. washed out frames score lower
+// - edges: fraction of pixels on a depth discontinuity or crease.
+//   geometry is noise free, so flat frames score lower
+//
+void renderThumbnails(std::atomic<int>* next, std::vector<candidate>* candidates, int width, int height, double gamma) {
+	const int block = 4;
+	std::size_t n = (std::size_t)width * height;
+	std::vector<double> luma(n);
+	std::vector<double> depth(n);
+	for (int i = next->fetch_add(1); i < (int)candidates->size(); i = next->fetch_add(1)) {
+		candidate& c = (*candidates)[i];
+		trace::scope scope("thumbnail", i);
+		seed* s = new seed(c.seed);
+		fractal* f = new fractal(s);
+		renderer* r = new renderer(width, height, s, f);
+		counters::scope counted(counters::RENDER);
+
 		//
-		// convert to portable network graphics format.
-		// all credits for this functionality go to Nayuki for writing
-		// the Tiny PNG Output library:
-		// https://www.nayuki.io/page/tiny-png-output
+		// a single sample of ambient occlusion shows the composition
+		// at a fraction of the cost. the depth comes from the
+		// sample's auxiliary outputs instead of another march
 		//
-		try {
-			// write image
-			std::ofstream out("render" + fileCountStr + ".png", std::ios::binary);
-			TinyPngOut pngout(static_cast<std::uint32_t>(width), static_cast<std::uint32_t>(height), out);
-			std::vector<std::uint8_t> line(static_cast<size_t>(width) * 3);
-			for (int y = 0; y < height; ++y) {
-				for (int x = 0; x < width; ++x) {
-					math::vec3 pixel = (*image)[y][x];
-					line[(long long)x * 3 + 0] = static_cast<uint8_t>(pixel.x);
-					line[(long long)x * 3 + 1] = static_cast<uint8_t>(pixel.y);
-					line[(long long)x * 3 + 2] = static_cast<uint8_t>(pixel.z);
+		r->setShading(2);
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				renderer::aov out;
+				math::vec3 pixel = r->render((double)height - ((double)y + 0.5), (double)x + 0.5, 1, 0, &out);
+				luma[(std::size_t)y * width + x] = std::pow(std::min(std::max(0.2126 * pixel.x + 0.7152 * pixel.y + 0.0722 * pixel.z, 0.0), 1.0), gamma);
+				depth[(std::size_t)y * width + x] = out.mask > 0.0 ? out.depth : -1.0;
+			}
+		}
+		delete s;
+		delete f;
+		delete r;
+
+		// depth discontinuity or crease around a pixel, including
+		// the fractal's silhouette against the sky
+		auto crease = [](double a, double b, double c) {
+			if ((a < 0.0) != (b < 0.0) || (b < 0.0) != (c < 0.0)) {
+				return true;
+			}
+			return std::abs(a + c - 2.0 * b) > 0.01 * b;
+		};
+		int hits = 0, edges = 0;
+		for (int y = 0; y < height; ++y) {
+			for (int x = 0; x < width; ++x) {
+				double d = depth[(std::size_t)y * width + x];
+				hits += d >= 0.0;
+				bool edge = x > 0 && x + 1 < width && crease(depth[(std::size_t)y * width + x - 1], d, depth[(std::size_t)y * width + x + 1]);
+				edge = edge || (y > 0 && y + 1 < height && crease(depth[(std::size_t)(y - 1) * width + x], d, depth[(std::size_t)(y + 1) * width + x]));
+				edges += edge;
+			}
+		}
+		std::vector<double> means;
+		for (int y = 0; y + block <= height; y += block) {
+			for (int x = 0; x + block <= width; x += block) {
+				double sum = 0.0;
+				for (int yy = y; yy < y + block; ++yy) {
+					for (int xx = x; xx < x + block; ++xx) {
+						sum += luma[(std::size_t)yy * width + xx];
+					}
 				}
-				pngout.write(line.data(), static_cast<size_t>(width));
+				means.push_back(sum / (block * block));
 			}
-			std::cout << "[+] Successfully stored png file to 'render" << fileCountStr << ".png'.\n\n";	
-		} catch (const char* message) {
-			std::cout << message << std::endl;
 		}
-	} else {
+		double mean = 0.0, variance = 0.0;
+		for (auto& m : means) {
+			mean += m / means.size();
+		}
+		for (auto& m : means) {
+			variance += (m - mean) * (m - mean) / means.size();
+		}
+		c.coverage = (double)hits / n;
+		c.contrast = std::sqrt(variance);
+		c.edges = (double)edges / n;
+		c.score = std::min(c.coverage / 0.25, 1.0) * c.contrast * c.edges;
+	}
+}
+
+//
+// exploration mode. draws random seeds, scores a single sample
+// thumbnail of each and fully renders the best ones. every seed is
+// stored at 'explore.txt' from best to worst, so that any of them
+// can be rendered later
+//
+void explore(int width, int height, int threadCount) {
+	int count = config::getInt("explore");
+	int keep = std::min(config::getInt("keep"), count);
+
+	// thumbnails keep the aspect ratio, with the longest side
+	// around 96 pixels
+	int scale = std::max(1, std::max(width, height) / 96);
+	int thumbWidth = std::max(1, width / scale);
+	int thumbHeight = std::max(1, height / scale);
+
+	//
+	// seeds are stored and parsed back before rendering, so that
+	// thumbnails and full renders see exactly what a seed file
+	// gives
+	//
+	std::vector<candidate> candidates(count);
+	for (auto& c : candidates) {
+		seed s;
+		c.seed = s.buildSeed();
+	}
+
+	std::cout << "[+] Scoring " << count << " random seeds at " << thumbWidth << "x" << thumbHeight << ".\n";
+	auto start = std::chrono::steady_clock::now();
+	std::atomic<int> next(0);
+	std::vector<std::thread> threads;
+	for (int i = 0; i < threadCount; ++i) {
+		threads.push_back(std::thread{renderThumbnails, &next, &candidates, thumbWidth, thumbHeight, config::getDouble("gamma")});
+	}
+	joinAll(threads);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "[+] Scored them in " << std::fixed << std::setprecision(2) << seconds << "s.\n";
+
+	std::stable_sort(candidates.begin(), candidates.end(), [](const candidate& a, const candidate& b) {
+		return a.score > b.score;
+	});
+	std::ofstream list("explore.txt");
+	for (auto& c : candidates) {
+		list << c.seed << "\n";
+	}
+	list.close();
+	std::cout << "[+] Successfully stored every seed from best to worst at 'explore.txt'.\n";
+
+	std::cout << "       rank     score  coverage  contrast     edges\n";
+	std::cout << std::setprecision(3);
+	for (int i = 0; i < keep; ++i) {
+		candidate& c = candidates[i];
+		std::cout << std::setw(11) << i + 1 << std::setw(10) << c.score << std::setw(10) << c.coverage;
+		std::cout << std::setw(10) << c.contrast << std::setw(10) << c.edges << "\n";
+	}
+	std::cout << "\n";
+
+	for (int i = 0; i < keep; ++i) {
+		auto start = std::chrono::steady_clock::now();
+		seed* s = new seed(candidates[i].seed);
+		fractal* f = new fractal(s);
+		renderer* r = new renderer(width, height, s, f);
+		renderSeed(s, r, width, height, threadCount, start);
+		delete s;
+		delete f;
+		delete r;
+	}
+}
+
+// size and number of the seeds rendered by the regression suite
+const int REGRESSION_SEEDS = 6;
+const int REGRESSION_WIDTH = 96;
+const int REGRESSION_HEIGHT = 64;
+
+// seeds and references are kept with the sources. the baseline
+// render times are measured on, and kept at, every machine
+const std::string REGRESSION_DIRECTORY = "regression/";
+
+// perceptual difference between two linear images. root mean
+// square error of their gamma encoded luminance, so that changes in
+// the shadows weigh as much as the eye sees them
+double perceptualError(const float* a, const float* b, std::size_t count) {
+	double sum = 0.0;
+	for (std::size_t i = 0; i < count; ++i) {
+		const float* p = a + i * 3;
+		const float* q = b + i * 3;
+		double la = std::pow(std::min(std::max(0.2126 * p[0] + 0.7152 * p[1] + 0.0722 * p[2], 0.0), 1.0), 0.45);
+		double lb = std::pow(std::min(std::max(0.2126 * q[0] + 0.7152 * q[1] + 0.0722 * q[2], 0.0), 1.0), 0.45);
+		sum += (la - lb) * (la - lb);
+	}
+	return std::sqrt(sum / count);
+}
+
+//
+// regression suite. renders a fixed set of stored seeds, with fixed
+// settings and a single thread so that renders are reproducible.
+// every image is compared against its stored reference, and the
+// total render time against the local baseline when there's one.
+// missing seeds and references fail the suite, and 'update' stores
+// the references and the baseline again. returns the process exit
+// code, which is non zero if anything drifted or is missing
+//
+int regress(bool update) {
+	config::set("samples", 1);
+	config::set("clamp", 1);
+	config::set("shading", 0);
+	config::set("sampler", 1);
+	config::set("fov", 45);
+	config::set("bounces", 2);
+	config::set("roulette", 2);
+	config::set("bounds", 1);
+	config::set("lod", 0);
+	config::set("budget", 0);
+	config::set("irradiance", 0);
+	double tolerance = config::getDouble("tolerance");
+	double slowdown = config::getDouble("slowdown");
+
+	// stored render time per seed, one per line
+	std::vector<double> baseline;
+	std::ifstream baselineFile(REGRESSION_DIRECTORY + "baseline.txt");
+	for (double seconds; baselineFile >> seconds; ) {
+		baseline.push_back(seconds);
+	}
+	baselineFile.close();
+	if ((int)baseline.size() != REGRESSION_SEEDS) {
+		baseline.clear();
+	}
+
+	std::cout << "[+] Rendering " << REGRESSION_SEEDS << " regression seeds at " << REGRESSION_WIDTH << "x" << REGRESSION_HEIGHT << ":\n";
+	std::cout << "       seed     error   seconds  baseline\n";
+	std::size_t pixels = (std::size_t)REGRESSION_WIDTH * REGRESSION_HEIGHT;
+	std::vector<float> image(pixels * 3);
+	std::vector<float> steps(pixels);
+	std::vector<double> times;
+	double total = 0.0, baselineTotal = 0.0;
+	bool failed = false;
+	if (update) {
+		std::error_code error;
+		std::filesystem::create_directories(REGRESSION_DIRECTORY, error);
+	}
+	for (int i = 0; i < REGRESSION_SEEDS; ++i) {
+		std::string name = REGRESSION_DIRECTORY + "seed" + std::to_string(i + 1);
+		std::ifstream seedFile(name + ".txt");
+		std::string seedData;
+		std::getline(seedFile, seedData);
+		seed* s = new seed(seedData);
+		if (!s->seedParsingSuccessful) {
+			std::cout << std::setw(11) << i + 1 << std::setw(10) << "no seed" << "\n";
+			delete s;
+			failed = true;
+			continue;
+		}
+		fractal* f = new fractal(s);
+		renderer* r = new renderer(REGRESSION_WIDTH, REGRESSION_HEIGHT, s, f);
+		auto start = std::chrono::steady_clock::now();
+		renderImage(REGRESSION_WIDTH, REGRESSION_HEIGHT, 1, false, -1, r, image.data(), steps.data(), nullptr, nullptr);
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		delete s;
+		delete f;
+		delete r;
+		times.push_back(seconds);
+		total += seconds;
+
+		std::string path = name + ".pfm";
+		std::vector<float> reference;
+		int referenceWidth, referenceHeight;
+		std::cout << std::fixed << std::setprecision(4);
+		std::cout << std::setw(11) << i + 1;
+		bool drift = false;
+		if (update) {
+			image::writePfm(path, image.data(), REGRESSION_WIDTH, REGRESSION_HEIGHT);
+			std::cout << std::setw(10) << "stored";
+		} else if (image::readPfm(path, reference, referenceWidth, referenceHeight) && referenceWidth == REGRESSION_WIDTH && referenceHeight == REGRESSION_HEIGHT) {
+			double error = perceptualError(image.data(), reference.data(), pixels);
+			std::cout << std::setw(10) << error;
+			drift = error > tolerance;
+		} else {
+			std::cout << std::setw(10) << "missing";
+			failed = true;
+		}
+		std::cout << std::setprecision(2) << std::setw(10) << seconds;
+		if (baseline.size()) {
+			std::cout << std::setw(10) << baseline[i];
+			baselineTotal += baseline[i];
+		}
+		std::cout << (drift ? "  drifted\n" : "\n");
+		failed = failed || drift;
+	}
+
+	if (update) {
+		std::ofstream out(REGRESSION_DIRECTORY + "baseline.txt");
+		for (auto& seconds : times) {
+			out << seconds << "\n";
+		}
+		std::cout << "[+] Stored references and baseline render times at '" << REGRESSION_DIRECTORY << "'.\n";
+	} else if (baseline.empty()) {
+		std::cout << "[+] No baseline render times at '" << REGRESSION_DIRECTORY << "baseline.txt', so render times aren't checked.\n";
+	} else if (total > baselineTotal * slowdown) {
+		failed = true;
+		std::cout << "[-] Rendering took " << total << "s against a baseline of " << baselineTotal << "s.\n";
+	}
+	std::cout << (failed ? "[-] Regression suite failed.\n" : "[+] Regression suite passed.\n");
+	return failed ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+	// base coordinates
+	double y = 0.5, x = 0.5;
+
+	// parse command line arguments. flags start with '--' and
+	// anything else is the location of a seed or pfm file, or the
+	// output directory of the server
+	bool scaling = false;
+	bool exploration = false;
+	int regression = 0;
+	bool serving = false;
+	std::string path;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--scaling") {
+			scaling = true;
+		} else if (arg == "--explore") {
+			exploration = true;
+		} else if (arg == "--serve") {
+			serving = true;
+		} else if (arg == "--ao") {
+			config::set("shading", 2);
+		} else if (arg == "--regress") {
+			regression = 1;
+		} else if (arg == "--regress-update") {
+			regression = 2;
+		} else if (path.empty() && arg.compare(0, 2, "--") != 0) {
+			path = arg;
+		} else {
+			std::cout << "[-] The only permissible arguments are '--scaling', '--explore', '--serve', '--ao', '--regress', '--regress-update' and a seed or pfm file's location.\n\n";
+			return 0;
+		}
+	}
+
+	//
+	// server mode. the standard output carries the protocol, so
+	// there's no presentation and the config's messages go to the
+	// standard error
+	//
+	if (serving) {
+		config::messagesTo(std::cerr);
+	}
+
+	// get config info
+	int width = config::getInt("width");
+	int height = config::getInt("height");
+	int threadCount = config::getInt("threads");
+
+	if (serving) {
+		return server::run(threadCount, path.empty() ? "." : path);
+	}
+
+	// record a timeline of every phase and thread
+	if (config::getInt("trace")) {
+		trace::start();
+	}
+
+	// count cpu events per phase
+	if (config::getInt("counters")) {
+		counters::start();
+	}
+
+	// init gui
+	gui::setup();
+
+	if (exploration) {
+		explore(width, height, threadCount);
+		writeProfile();
+		std::cout << "\033[0m";
+		return 0;
+	}
+
+	if (regression) {
+		int code = regress(regression == 2);
+		writeProfile();
+		std::cout << "\n\033[0m";
+		return code;
+	}
+
+	// pointer to seed object and parsing user input
+	seed* s;
+	if (endsWith(path, ".pfm")) {
 		//
-		// write image data to ppm file
+		// re-grade a previously stored linear render. no rendering
+		// is involved, only tonemapping
 		//
-		std::ofstream out("render" + fileCountStr + ".ppm");
-		out << "P3\n" << width << ' ' << height << ' ' << 255 << '\n';
-		for (int i = 0; i < height; ++i) {
-			for (int j = 0; j < width; ++j) {
-				math::vec3 pixel = (*image)[i][j];
-				out << (int)pixel.x << ' ' << (int)pixel.y << ' ' << (int)pixel.z << '\n';
+		std::vector<float> hdr;
+		int hdrWidth, hdrHeight;
+		if (!image::readPfm(path, hdr, hdrWidth, hdrHeight)) {
+			std::cout << "[-] Couldn't read specified pfm file.\n\n";
+			return 0;
+		}
+		std::cout << "[+] Successfully read pfm file from '" << path << "'.\n";
+		writeGraded(hdr.data(), hdrWidth, hdrHeight, "render" + nextFileCount());
+		std::cout << "\n\033[0m";
+		return 0;
+	} else if (!path.empty()) {
+		std::ifstream seedFile(path);
+		if (!seedFile.good()) {
+			std::cout << "[-] Couldn't find specified seed file.\n\n";
+			return 0;
+		}
+		std::string seedData;
+		std::getline(seedFile, seedData);
+		s = new seed(seedData);
+		if (!s->seedParsingSuccessful) {
+			std::cout << "[-] Seed not valid.\n\n";
+			delete s;
+			return 0;
+		}
+		std::cout << "[+] Successfully read seed from '" << path << "'.\n";
+	} else {
+		s = new seed();
+	}
+
+	//
+	// the camera search and the sky gradient draw from the seed's
+	// rng, whose state depends on how the seed was made. the seed
+	// is parsed back from its stored form, like exploration does,
+	// so that renders, cached renders and the seed file agree
+	//
+	seed* stored = new seed(s->buildSeed());
+	delete s;
+	s = stored;
+
+	// deadline bounded renders count their budget from here
+	auto began = std::chrono::steady_clock::now();
+
+	// pointer to fractal object
+	fractal* f = new fractal(s);
+
+	// pointer to renderer object
+	renderer* r = new renderer(width, height, s, f);
+
+	//
+	// scaling mode. renders the image with 1, 2, 4... threads up
+	// to the configured count and reports how well it scales
+	//
+	if (scaling) {
+		bool pin = config::getInt("pin");
+		std::cout << "[+] Scaling from 1 to " << threadCount << " threads" << (pin ? ", pinned" : "") << ":\n";
+		std::cout << "    threads   seconds   speedup  efficiency\n";
+		double base = 0.0;
+		for (int count = 1; count <= threadCount; count = count * 2 > threadCount && count < threadCount ? threadCount : count * 2) {
+			float* image = new float[(std::size_t)width * height * 3];
+			float* steps = new float[(std::size_t)width * height];
+			auto start = std::chrono::steady_clock::now();
+			renderImage(width, height, count, pin, -1, r, image, steps, nullptr, nullptr);
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if (count == 1) {
+				base = seconds;
 			}
+			std::cout << std::fixed << std::setprecision(2);
+			std::cout << std::setw(11) << count << std::setw(10) << seconds << std::setw(9) << base / seconds << "x";
+			std::cout << std::setw(11) << 100.0 * base / seconds / count << "%\n";
+			delete[] image;
+			delete[] steps;
 		}
-		std::cout << "[+] Successfully store ppm file to 'render" << fileCountStr << ".ppm'.\n\n";
+		delete s;
+		delete f;
+		delete r;
+		writeProfile();
+		std::cout << "\n\033[0m";
+		return 0;
 	}
 
+	//
+	// render the seed and store every output
+	//
+	renderSeed(s, r, width, height, threadCount, began);
+	writeProfile();
+
 	//
 	// free heap allocated memory
 	//
 	delete s;
 	delete f;
 	delete r;
-	delete image;
 
 	// correct teminal color pallette
 	std::cout << "\033[0m";
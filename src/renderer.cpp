@@ -6,11 +6,21 @@
 #include "renderer.h"
 #include "seed.h"
 #include "config.h"
+#include "counters.h"
+#include "trace.h"
 
 #include <iostream>
 
 const double MAX_DIST = 256.0;
 const double MIN_DIST = 1e-5;
+const double SHADOW_DIST = 1e-3;
+const double SKY_DISTANCE = 16.0;
+const double SURFACE_BIAS = 2e-3;
+const double OCCLUSION_SHADOW_DIST = 2.0;
+const int IRRADIANCE_THETA = 3;
+const int IRRADIANCE_PHI = 8;
+const double IRRADIANCE_REACH_MIN = 16.0;
+const double IRRADIANCE_REACH_MAX = 128.0;
 const double PI = 3.14159265358979;
 
 void renderer::updateRotationMatrix() {
@@ -126,9 +136,41 @@ renderer::renderer(int WIDTH, int HEIGHT, seed* s, fractal* f) 	: WIDTH(WIDTH),
 	// get sample value from config file
 	SAMPLES = config::getInt("samples");
 
+	// whether samples are clamped before they're averaged
+	CLAMP = config::getInt("clamp");
+
 	// get surface bounces per ray
 	BOUNCES = config::getInt("bounces");
 
+	// get bounces traced before russian roulette is applied
+	ROULETTE = config::getInt("roulette");
+
+	// get shading mode
+	SHADING = config::getInt("shading");
+	SAMPLER = config::getInt("sampler");
+
+	// get maximum steps per marched ray
+	STEP_BUDGET = config::getInt("budget");
+
+	// whether rays are clipped against the fractal's bounds
+	BOUNDS = config::getInt("bounds");
+
+	// whether hit distance and iterations depend on the pixel's
+	// footprint
+	LOD = config::getInt("lod");
+
+	// largest error allowed when interpolating sky light, or zero
+	// to sample it at every bounce
+	IRRADIANCE = config::getDouble("irradiance");
+
+	// angle covered by one pixel, as set up by
+	// calculateRayDirection
+	PIXEL_ANGLE = std::tan(FOV * PI / 180.0 / 2.0) / HEIGHT;
+
+	// the first level of the irradiance cache has cells as wide as
+	// a pixel one unit away from the camera
+	irradiance = IRRADIANCE > 0.0 ? new irradianceCache(IRRADIANCE, PIXEL_ANGLE) : nullptr;
+
 	// set lower bound for randomness in sky noise
 	SKY_NOISE = std::min(std::max(0.8, SAMPLES / 8.0), 1.0);
 
@@ -147,24 +189,59 @@ renderer::renderer(int WIDTH, int HEIGHT, seed* s, fractal* f) 	: WIDTH(WIDTH),
 	dir.y = s->values["ycameraDirection"];
 	dir.z = s->values["zcameraDirection"];
 	double distance = s->values["cameraDistance"];
-	for (double radius = 0.0; radius < MAX_DIST; ) {
-		cameraPosition = dir * radius;
-		updateRotationMatrix();
-		++radius;
-		if (f->de(cameraPosition) < distance) continue;
-		bool hit = false;
+	{
+		trace::scope cameraSearch("camera search");
+		counters::scope counted(counters::CAMERA_SEARCH);
+		for (double radius = 0.0; radius < MAX_DIST; ) {
+			cameraPosition = dir * radius;
+			updateRotationMatrix();
+			++radius;
+			if (f->de(cameraPosition) < distance) continue;
+			bool hit = false;
+			for (int i = 0; i < 64; ++i) {
+				double y = HEIGHT * s->d(0.0, 1.0);
+				double x = WIDTH * s->d(0.0, 1.0);
+				double d = march({cameraPosition, calculateRayDirection(x, y)});
+				if (d != -1.0) {
+					hit = true;
+					break;
+				}
+			}
+			if (hit) {
+				break;
+			}
+		}
+	}
+
+	//
+	// level of detail calibration. the error of truncating the
+	// distance estimator to fewer iterations is measured at some
+	// surface points seen by the camera
+	//
+	if (LOD) {
+		trace::scope calibration("lod calibration");
+		int n = f->getIterations();
+		std::vector<double> error(n + 1, 0.0);
+		error[0] = 1e20;
 		for (int i = 0; i < 64; ++i) {
 			double y = HEIGHT * s->d(0.0, 1.0);
 			double x = WIDTH * s->d(0.0, 1.0);
-			double d = march({cameraPosition, calculateRayDirection(x, y)});
-			if (d != -1.0) {
-				hit = true;
-				break;
+			math::ray ray(cameraPosition, calculateRayDirection(x, y));
+			double d = march(ray);
+			if (d == -1.0) {
+				continue;
+			}
+			math::vec3 point = ray.origin + ray.direction * d;
+			double full = f->de(point);
+			for (int k = 1; k < n; ++k) {
+				error[k] = std::max(error[k], std::abs(f->de(point, k) - full));
 			}
 		}
-		if (hit) {
-			break;
+		// fewer iterations are never more accurate than more
+		for (int k = n - 1; k > 0; --k) {
+			error[k] = std::max(error[k], error[k + 1]);
 		}
+		lodError = error;
 	}
 
 	// get directional light direction
@@ -185,27 +262,189 @@ renderer::renderer(int WIDTH, int HEIGHT, seed* s, fractal* f) 	: WIDTH(WIDTH),
 
 // raymarch
 double renderer::march(math::ray r) {
+	int iters = f->getIterations();
+	return march(r, 0.0, iters);
+}
+
+double renderer::march(math::ray r, double travelled, int& iters, int* steps) {
+	++fractal::rays;
 	double t = MIN_DIST;
-	for (; t < MAX_DIST; ) {
-		double h = f->de(r.origin + r.direction * t);
-		if (h < MIN_DIST) {
+	double tmax = MAX_DIST;
+	double eps = MIN_DIST;
+
+	//
+	// clip the ray against the fractal's bounding sphere. rays
+	// that miss it can't hit anything, and the ones that hit it
+	// start marching at the point where they enter it
+	//
+	if (BOUNDS) {
+		double enter, exit;
+		if (!f->clip(r, enter, exit)) {
+			if (steps) {
+				*steps = 0;
+			}
+			return -1.0;
+		}
+		t = std::max(t, enter);
+		tmax = std::min(tmax, exit);
+	}
+
+	int step = 0;
+	for (; t < tmax; ++step) {
+		//
+		// step budget. a ray that runs out of steps is grazing the
+		// surface, so it's considered a hit where it stopped
+		//
+		if (STEP_BUDGET > 0 && step >= STEP_BUDGET) {
 			break;
 		}
+
+		//
+		// level of detail. the hit distance grows with the width
+		// of the pixel's cone, and iterations are dropped while
+		// the error they introduce is below it
+		//
+		if (LOD) {
+			eps = std::max(MIN_DIST, (travelled + t) * PIXEL_ANGLE * 0.5);
+			while (iters > 1 && !lodError.empty() && lodError[iters - 1] <= eps) {
+				--iters;
+			}
+		}
+		double h = f->de(r.origin + r.direction * t, iters);
+		if (h < eps) {
+			break;
+		}
+		t += h;
+	}
+	if (steps) {
+		*steps = step;
+	}
+	if (t < tmax) return t;
+	return -1.0;
+}
+
+double renderer::visibility(math::ray r, double eps, int iters) {
+	++fractal::rays;
+	double t = 0.0;
+	double tmax = SKY_DISTANCE;
+	if (BOUNDS) {
+		double enter, exit;
+		if (!f->clip(r, enter, exit)) {
+			return -1.0;
+		}
+		tmax = std::min(tmax, exit);
+	}
+	for (int steps = 0; t < tmax && (STEP_BUDGET <= 0 || steps < STEP_BUDGET); ++steps) {
+		double h = f->de(r.origin + r.direction * t, iters);
+		if (h < eps) {
+			return t;
+		}
 		t += h;
 	}
-	if (t < MAX_DIST) return t;
 	return -1.0;
 }
 
-math::vec3 renderer::brdf(math::vec3 direction, math::vec3 normal) {
-	if (s->d(0.0, 1.0) > GLOSSINESS_CHANCE) {
+double renderer::skyVisibility(math::vec3 point, math::vec3 normal, double travelled, double hitEps, int iters) {
+	double value;
+	if (irradiance->lookup(point, normal, value)) {
+		return value;
+	}
+
+	//
+	// sample the hemisphere in strata of equal projected area, so
+	// that every ray has the same weight. theta grows with 'j' and
+	// phi with 'k'
+	//
+	const int M = IRRADIANCE_THETA;
+	const int N = IRRADIANCE_PHI;
+	math::vec3 u = math::normalize(math::cross(std::abs(normal.x) > 0.9 ? math::vec3(0.0, 1.0, 0.0) : math::vec3(1.0, 0.0, 0.0), normal));
+	math::vec3 v = math::cross(normal, u);
+	math::vec3 origin = point + normal * std::max(SURFACE_BIAS, 2.0 * hitEps);
+	double shadowEps = std::max(SHADOW_DIST, hitEps);
+	double L[M][N];
+	double R[M][N];
+	double inverseDistances = 0.0;
+	for (int j = 0; j < M; ++j) {
+		double sinTheta = std::sqrt((j + 0.5) / M);
+		double cosTheta = std::sqrt(1.0 - sinTheta * sinTheta);
+		for (int k = 0; k < N; ++k) {
+			double phi = 2.0 * PI * (k + 0.5) / N;
+			math::vec3 dir = u * (std::cos(phi) * sinTheta) + v * (std::sin(phi) * sinTheta) + normal * cosTheta;
+			double d = visibility({origin, dir}, shadowEps, iters);
+			L[j][k] = d == -1.0 ? 1.0 : 0.0;
+			R[j][k] = d == -1.0 ? MAX_DIST : std::max(d, MIN_DIST);
+			inverseDistances += 1.0 / R[j][k];
+		}
+	}
+
+	//
+	// value and gradients. the rotational gradient tells how the
+	// value changes as the normal tilts, and the translational one
+	// how it changes as the point moves along the surface, from the
+	// differences between neighbouring strata and the distance to
+	// what separates them
+	//
+	irradianceCache::record r;
+	r.position = point;
+	r.normal = normal;
+	r.value = 0.0;
+	r.rotation = math::vec3(0.0);
+	r.translation = math::vec3(0.0);
+	for (int k = 0; k < N; ++k) {
+		double phi = 2.0 * PI * (k + 0.5) / N;
+		double phiMinus = 2.0 * PI * k / N;
+		math::vec3 uk = u * std::cos(phi) + v * std::sin(phi);
+		math::vec3 vk = u * -std::sin(phi) + v * std::cos(phi);
+		math::vec3 vkMinus = u * -std::sin(phiMinus) + v * std::cos(phiMinus);
+		int kPrev = (k + N - 1) % N;
+		double rotation = 0.0, radial = 0.0, azimuthal = 0.0;
+		for (int j = 0; j < M; ++j) {
+			double sinTheta = std::sqrt((j + 0.5) / M);
+			double cosTheta = std::sqrt(1.0 - sinTheta * sinTheta);
+			double sinMinus = std::sqrt((double)j / M);
+			double sinPlus = std::sqrt((j + 1.0) / M);
+			r.value += L[j][k];
+			rotation -= sinTheta / cosTheta * L[j][k];
+			if (j > 0) {
+				radial += sinMinus * (1.0 - sinMinus * sinMinus) / std::min(R[j][k], R[j - 1][k]) * (L[j][k] - L[j - 1][k]);
+			}
+			azimuthal += cosTheta * (sinPlus - sinMinus) / std::min(R[j][k], R[j][kPrev]) * (L[j][k] - L[j][kPrev]);
+		}
+		r.rotation += vk * rotation;
+		r.translation += uk * (radial * 2.0 * PI / N) + vkMinus * azimuthal;
+	}
+	r.value /= M * N;
+	r.rotation /= M * N;
+	r.translation /= PI;
+
+	//
+	// records reach further where the geometry around them is far
+	// away. they're kept between IRRADIANCE_REACH_MIN and
+	// IRRADIANCE_REACH_MAX pixels at the distance they're at, since
+	// a record costs as many rays as a couple dozen lookups save.
+	// the gradient limit comes last: extrapolating further would
+	// change the value by more than the allowed error, and clamping
+	// those values to the [0, 1] range brightens the image
+	//
+	double footprint = std::max(travelled, MIN_DIST) * PIXEL_ANGLE;
+	r.radius = std::min(std::max(M * N / inverseDistances, IRRADIANCE_REACH_MIN * footprint / IRRADIANCE), IRRADIANCE_REACH_MAX * footprint / IRRADIANCE);
+	double gradient = math::length(r.translation);
+	if (gradient > 0.0) {
+		r.radius = std::min(r.radius, 1.0 / gradient);
+	}
+	irradiance->insert(r);
+	return r.value;
+}
+
+math::vec3 renderer::brdf(math::vec3 direction, math::vec3 normal, sampler& rand) {
+	if (rand.next() > GLOSSINESS_CHANCE) {
 		//
 		// diffuse reflection without tangent thanks to Edd 
 		// Biddulph:
 		// http://www.amietia.com/lambertnotangent.html
 		//
-		double a = s->d(0.0, 1.0);
-		double b = s->d(0.0, 1.0);
+		double a, b;
+		rand.next(a, b);
 		// not an arbitrary number, it's pi * 2
 		double theta = 6.283185 * a;
 		b = 2.0 * b - 1.0;
@@ -226,37 +465,177 @@ math::vec3 renderer::brdf(math::vec3 direction, math::vec3 normal) {
 }
 
 renderer::~renderer() {
+	delete irradiance;
+}
+
+void renderer::clearCache() {
+	if (irradiance) {
+		irradiance->clear();
+	}
 }
 
 math::vec3 renderer::render(double y, double x) {
+	return render(y, x, (aov*)nullptr);
+}
+
+math::vec3 renderer::render(double y, double x, aov* out) {
+	bounce* record = nullptr;
+	if (!paths.empty()) {
+		std::size_t pixel = (std::size_t)std::floor(y) * WIDTH + (std::size_t)std::floor(x);
+		record = &paths[pixel * SAMPLES * BOUNCES];
+	}
+	return render(y, x, SAMPLES, 0, out, record);
+}
+
+bool renderer::record() {
+	bool roulette = ROULETTE > 0 && ROULETTE < BOUNCES;
+	ROULETTE = 0;
+	paths.assign((std::size_t)WIDTH * HEIGHT * SAMPLES * BOUNCES, bounce());
+	return roulette;
+}
+
+std::size_t renderer::recordBytes() {
+	return (std::size_t)WIDTH * HEIGHT * SAMPLES * BOUNCES * sizeof(bounce);
+}
+
+math::vec3 renderer::shade(double y, double x) {
+	int samples = getSamples();
+	std::size_t pixel = (std::size_t)std::floor(y) * WIDTH + (std::size_t)std::floor(x);
+	math::vec3 color(0.0);
+	for (int i = 0; i < samples; ++i) {
+		const bounce* path = &paths[(pixel * SAMPLES + i) * BOUNCES];
+		math::vec3 colorLeft(1.0);
+		math::vec3 colorAccumulated(0.0);
+		double fdist = 0.0;
+		if (path[0].distance < 0.0f) {
+			colorAccumulated = renderSky(y, x);
+		} else {
+			fdist = path[0].distance;
+		}
+
+		//
+		// the same shading as render, bounce by bounce, with the
+		// visibilities it found
+		//
+		for (int j = 0; j < BOUNCES && path[j].distance >= 0.0f; ++j) {
+			math::vec3 colorAtPoint = f->colorOfTrap(math::vec3(path[j].trap[0], path[j].trap[1], path[j].trap[2]));
+			if (SHADING == 1 || (LOD && j > 0)) {
+				colorAtPoint = math::clamp(colorAtPoint, 0.0, 1.0);
+			}
+			if (SHADING == 2) {
+				colorAccumulated = colorAtPoint * (lightColor * path[j].light + skyColor * path[j].sky);
+				break;
+			}
+			math::vec3 colorLighting = lightColor * path[j].light;
+			if (SHADING == 0) {
+				colorLighting += skyColor * path[j].sky;
+			}
+			colorLeft *= colorAtPoint;
+			colorAccumulated += colorLeft * colorLighting;
+			if (SHADING == 1) {
+				colorAccumulated += colorLeft * skyColor * path[j].sky;
+			}
+		}
+
+		double ff = std::exp(-0.01 * fdist * fdist);
+		colorAccumulated *= ff;
+		colorAccumulated += math::vec3(0.9, 1.0, 1.0) * (1.0 - ff) *0.05;
+		color += CLAMP ? math::clamp(colorAccumulated, 0.0, 1.0) : colorAccumulated;
+	}
+	color /= (double)samples;
+	return color;
+}
+
+void renderer::setShading(int shading) {
+	SHADING = shading;
+}
+
+int renderer::getSamples() {
+	// ambient occlusion doesn't draw random rays, so without
+	// sub-pixel jitter every sample would come out the same
+	return SHADING == 2 && SAMPLER != 1 ? 1 : SAMPLES;
+}
+
+math::vec3 renderer::render(double y, double x, int samples) {
+	return render(y, x, samples, 0);
+}
+
+math::vec3 renderer::render(double y, double x, int samples, int first) {
+	return render(y, x, samples, first, nullptr);
+}
+
+math::vec3 renderer::render(double y, double x, int samples, int first, aov* out) {
+	return render(y, x, samples, first, out, nullptr);
+}
+
+math::vec3 renderer::render(double y, double x, int samples, int first, aov* out, bounce* record) {
 
 	// get ray direction relative to the pixel being rendered
 	// coordinates and rotate it
 	math::vec3 dir = calculateRayDirection(x, y);
 	math::vec3 color(0.0);
+	std::uint32_t pixel = (std::uint32_t)std::floor(y) * (std::uint32_t)WIDTH + (std::uint32_t)std::floor(x);
+
+	// see getSamples
+	if (SHADING == 2 && SAMPLER != 1) {
+		samples = 1;
+	}
+	if (out) {
+		*out = { 0.0, math::vec3(0.0), math::vec3(0.0), 0.0, 0.0 };
+	}
 
 	//
 	// render same pixel multiple times
 	//
-	for (int i = 0; i < SAMPLES; ++i) {
+	for (int i = 0; i < samples; ++i) {
 
 		//
-		// data per sample
+		// data per sample. stratified samples are spread over the
+		// whole pixel, which antialiases edges
 		//
+		sampler rand(s, SAMPLER == 1, pixel, first + i);
 		math::ray r(cameraPosition, dir);
+		if (SAMPLER == 1) {
+			double jy, jx;
+			rand.next(jy, jx);
+			r.direction = calculateRayDirection(x + jx - 0.5, y + jy - 0.5);
+		}
 		math::vec3 colorLeft(1.0);
 		math::vec3 colorAccumulated(0.0);
+		bounce* path = record ? record + (std::size_t)i * BOUNCES : nullptr;
 
 		//
 		// path tracing
 		//
 		double fdist = 0.0;
+		double travelled = 0.0;
+		int iters = f->getIterations();
+		math::vec3 skyPending(0.0);
 		for (int i = 0; i < BOUNCES; ++i) {
 
 			//
 			// get distance from fractal marching the ray's direction
 			//
-			double distance = march(r);
+			int steps;
+			double distance = march(r, travelled, iters, out && i == 0 ? &steps : nullptr);
+			if (out && i == 0) {
+				out->steps += steps;
+			}
+			if (path) {
+				path[i].distance = (float)distance;
+				if (SHADING == 1 && i > 0) {
+					path[i - 1].sky = distance == -1.0 || distance > SKY_DISTANCE ? 1.0f : 0.0f;
+				}
+			}
+
+			//
+			// shared sky ray. the sky light of the previous bounce
+			// is visible if this ray escapes the shadow distance
+			//
+			if (SHADING == 1 && (distance == -1.0 || distance > SKY_DISTANCE)) {
+				colorAccumulated += skyPending;
+			}
+
 			if (distance == -1.0) {
 				if (i == 0) {
 					colorAccumulated = renderSky(y, x);
@@ -270,17 +649,60 @@ math::vec3 renderer::render(double y, double x) {
 			if (i == 0) {
 				fdist = distance;
 			}
+			travelled += distance;
+			double hitEps = LOD ? std::max(MIN_DIST, travelled * PIXEL_ANGLE * 0.5) : MIN_DIST;
+			double shadowEps = std::max(SHADOW_DIST, hitEps);
 
 			//
 			// get current position and normal
 			//
 			math::vec3 point = r.origin + r.direction * distance;
-			math::vec3 normal = f->calculateNormal(point);	
+			math::vec3 normal = f->calculateNormal(point, iters);
 
 			//
 			// get fractal surface color
 			//
-			math::vec3 colorAtPoint = f->calculateColor(point);
+			math::vec3 trap = f->calculateTrap(point);
+			math::vec3 colorAtPoint = f->colorOfTrap(trap);
+			if (path) {
+				path[i].trap[0] = (float)trap.x;
+				path[i].trap[1] = (float)trap.y;
+				path[i].trap[2] = (float)trap.z;
+			}
+			// orbit trap colors can go above one. bounce rays leave
+			// the surface in the shared sky mode, and sometimes do so
+			// with the wider hit distance of level of detail, so the
+			// color they carry has to be kept from growing on every
+			// bounce
+			if (SHADING == 1 || (LOD && i > 0)) {
+				colorAtPoint = math::clamp(colorAtPoint, 0.0, 1.0);
+			}
+			if (out && i == 0) {
+				out->depth += distance;
+				out->normal += normal;
+				out->albedo += colorAtPoint;
+				out->mask += 1.0;
+			}
+
+			//
+			// ambient occlusion. no bounces: the sky light is
+			// estimated from the distance field around the point, and
+			// the sun from a single shadow ray that gives up early
+			//
+			if (SHADING == 2) {
+				double dl = std::max(0.0, math::dot(lightDirection, normal));
+				double dlShadow = 1.0;
+				if (dl > 0.0) {
+					dlShadow = f->calculateShadow({point + normal * std::max(SURFACE_BIAS, 2.0 * hitEps), lightDirection}, iters, shadowEps, OCCLUSION_SHADOW_DIST);
+				}
+				double occlusion = f->calculateOcclusion(point, normal, iters);
+				colorAccumulated = colorAtPoint * (lightColor * dl * dlShadow + skyColor * occlusion);
+				if (path) {
+					path[i].light = (float)(dl * dlShadow);
+					path[i].sky = (float)occlusion;
+				}
+				break;
+			}
 
 			math::vec3 colorLighting(0.0);
 			//
@@ -289,15 +711,26 @@ math::vec3 renderer::render(double y, double x) {
 			double dl = std::max(0.0, math::dot(lightDirection, normal));
 			double dlShadow = 1.0;
 			if (dl > 0.0) {
-				dlShadow = f->calculateShadow({r.origin + r.direction * MIN_DIST, lightDirection});
+				dlShadow = f->calculateShadow({r.origin + r.direction * MIN_DIST, lightDirection}, iters, shadowEps);
 			}
 			colorLighting += lightColor * dl * dlShadow;
+			if (path) {
+				path[i].light = (float)(dl * dlShadow);
+			}
 
 			//
-			// sky light
+			// sky light. when it's shared with the bounce ray, it's
+			// added once the next march knows whether it's visible.
+			// when it's cached, it's the visibility of the whole sky
+			// instead of a single random direction
 			//
-			double skyShadow = f->calculateShadow({r.origin + r.direction * MIN_DIST, brdf(r.direction, normal)});
-			colorLighting += skyColor * skyShadow;
+			if (SHADING == 0) {
+				double skyShadow = irradiance ? skyVisibility(point, normal, travelled, hitEps, iters) : f->calculateShadow({r.origin + r.direction * MIN_DIST, brdf(r.direction, normal, rand)}, iters, shadowEps);
+				colorLighting += skyColor * skyShadow;
+				if (path) {
+					path[i].sky = (float)skyShadow;
+				}
+			}
 
 			//
 			// add bounce color to sample color
@@ -305,11 +738,43 @@ math::vec3 renderer::render(double y, double x) {
 			colorLeft *= colorAtPoint;
 			colorAccumulated += colorLeft * colorLighting;
 
+			//
+			// russian roulette. after the first ROULETTE bounces, a
+			// path survives with a probability equal to the color it
+			// still carries, and the survivors are reweighted so that
+			// the average stays the same
+			//
+			if (ROULETTE > 0 && i + 1 >= ROULETTE && i + 1 < BOUNCES) {
+				double survival = std::min(1.0, std::max(colorLeft.x, std::max(colorLeft.y, colorLeft.z)));
+				if (rand.next() >= survival) {
+					break;
+				}
+				colorLeft /= survival;
+			}
+
 			//
 			// bounce ray
 			//
 			r.origin = point;
-			r.direction = brdf(r.direction, normal);
+			r.direction = brdf(r.direction, normal, rand);
+
+			//
+			// the shared sky ray leaves the surface along the normal
+			// so that it doesn't hit the point it starts from. the
+			// last bounce has no next march, so its sky light is
+			// probed with a shadow ray in the same direction
+			//
+			if (SHADING == 1) {
+				r.origin = point + normal * std::max(SURFACE_BIAS, 2.0 * hitEps);
+				skyPending = colorLeft * skyColor;
+				if (i + 1 == BOUNCES) {
+					double sky = f->calculateShadow(r, iters, shadowEps);
+					colorAccumulated += skyPending * sky;
+					if (path) {
+						path[i].sky = (float)sky;
+					}
+				}
+			}
 		}
 
 		//
@@ -320,17 +785,24 @@ math::vec3 renderer::render(double y, double x) {
 		colorAccumulated += math::vec3(0.9, 1.0, 1.0) * (1.0 - ff) *0.05;
 
 		//
-		// add clamped sample color to average color
+		// add sample color to average color. unless samples are
+		// clamped, light above one is kept for the linear outputs
 		//
-		color += math::clamp(colorAccumulated, 0.0, 1.0);
+		color += CLAMP ? math::clamp(colorAccumulated, 0.0, 1.0) : colorAccumulated;
+	}
+	//get average of paths colors.
+	//exposure, clamping and gamma correction are applied later
+	//on the whole image by image::tonemap
+	color /= (double)samples;
+	if (out) {
+		if (out->mask > 0.0) {
+			out->depth /= out->mask;
+			out->normal /= out->mask;
+			out->albedo /= out->mask;
+		}
+		out->steps /= samples;
+		out->mask /= samples;
 	}
-	//get average of paths colors
-	color /= (double)SAMPLES;
-
-	// apply gamma correction
-	color.x = pow(color.x, 0.45);
-	color.y = pow(color.y, 0.45);
-	color.z = pow(color.z, 0.45);
 
-	return color * 255.0;
+	return color;
 }
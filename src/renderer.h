@@ -7,6 +7,8 @@
 
 #include "math.h"
 #include "fractal.h"
+#include "irradiance.h"
+#include "sampler.h"
 
 #include <vector>
 
@@ -16,7 +18,16 @@ class renderer {
 		int HEIGHT;
 		int FOV;
 		int SAMPLES;
+		int CLAMP;
 		int BOUNCES;
+		int ROULETTE;
+		int SHADING;
+		int SAMPLER;
+		int BOUNDS;
+		int STEP_BUDGET;
+		int LOD;
+		double IRRADIANCE;
+		double PIXEL_ANGLE;
 		double SKY_NOISE;
 		double GLOSSINESS_CHANCE;
 		double GLOSSINESS_AMOUNT;
@@ -27,6 +38,14 @@ class renderer {
 		std::vector<math::vec3> RMx;
 		std::vector<math::vec3> RMy;
 
+		// error of the distance estimator when truncated to a
+		// given number of iterations
+		std::vector<double> lodError;
+
+		// sky visibility records shared by every thread. null if
+		// irradiance caching is disabled
+		irradianceCache* irradiance;
+
 		// object pointers
 		fractal* f;
 		seed* s;
@@ -39,27 +58,121 @@ class renderer {
 		// yaw and pitch rotation to it
 		math::vec3 calculateRayDirection(double y, double x);
 
-		// ray march a ray. return negative if nothing was hit
+		// ray march a ray. return negative if nothing was hit.
+		// rays that run out of step budget are considered a hit
 		double march(math::ray r);
 
+		// same as above, for a ray that already travelled some
+		// distance along its path. 'iters' is the number of
+		// fractal iterations the ray starts with, and it's lowered
+		// to the number used at the hit. the number of steps taken
+		// is stored at 'steps' if it isn't null
+		double march(math::ray r, double travelled, int& iters, int* steps = nullptr);
+
+		// distance along a ray to the fractal, marched with a custom
+		// hit distance and only as far as the sky can be blocked.
+		// negative if nothing was hit
+		double visibility(math::ray r, double eps, int iters);
+
+		// fraction of the sky seen by a surface point, weighted by
+		// the cosine with its normal. it's interpolated from the
+		// irradiance cache, or sampled and stored there if no record
+		// reaches the point. 'travelled' is the distance from the
+		// camera along the path, which sets the records' spacing
+		double skyVisibility(math::vec3 point, math::vec3 normal, double travelled, double hitEps, int iters);
+
 		// in case the ray dosn't hit a system
 		math::vec3 renderSky(double y, double x);
 
 		// bidirectional reflectance distribution function.
-		// returns a random direction in which a normal might reflect
+		// returns a direction drawn from the sampler in which a normal might reflect
 		// an incoming ray.
 		// it might return either a direction generated by a cosine
 		// distribution function (for lambertian reflection) or a value
 		// generated by a cone distribution function (for glossy
 		// reflection).
-		math::vec3 brdf(math::vec3 direction, math::vec3 normal);
+		math::vec3 brdf(math::vec3 direction, math::vec3 normal, sampler& rand);
 
 		// main rendering function
 		math::vec3 pathTrace(math::ray r, int levelsLeft);
 
 	public:
+		// geometry of a path at one bounce: the distance marched,
+		// negative if nothing was hit, and the orbit trap, sun
+		// visibility and sky visibility at the hit. it's all the
+		// shading needs besides the seed's colors
+		struct bounce {
+			float distance;
+			float trap[3];
+			float light;
+			float sky;
+		};
+
+		// recorded paths, 'BOUNCES' per sample and every sample of
+		// a pixel in a row. empty unless 'record' was called
+		std::vector<bounce> paths;
+
+		// auxiliary outputs of a pixel. 'steps' is the number of
+		// march steps of the camera rays, and 'mask' the fraction
+		// of them that hit the fractal. depth, normal and albedo
+		// come from the first hit and are averaged over the samples
+		// that hit, and they're zero if none did
+		struct aov {
+			double depth;
+			math::vec3 normal;
+			math::vec3 albedo;
+			double steps;
+			double mask;
+		};
+
 		renderer(int width, int height, seed* s, fractal* f);
 		~renderer();
 
+		// returns the linear, unclamped color of the pixel
 		math::vec3 render(double y, double x);
+
+		// same as above, with a custom number of samples. used
+		// by low resolution previews
+		math::vec3 render(double y, double x, int samples);
+
+		// same as above, starting at sample 'first' of the pixel.
+		// used by progressive renders, so that every pass takes
+		// new samples
+		math::vec3 render(double y, double x, int samples, int first);
+
+		// same as above, also filling the pixel's auxiliary outputs
+		// if 'out' isn't null. they're taken along the way, so they
+		// cost next to nothing
+		math::vec3 render(double y, double x, int samples, int first, aov* out);
+		math::vec3 render(double y, double x, aov* out);
+
+		// same as above, storing the path of every sample at
+		// 'record' if it isn't null, 'BOUNCES' bounces per sample
+		math::vec3 render(double y, double x, int samples, int first, aov* out, bounce* record);
+
+		// start recording the paths of every sample taken by
+		// render(y, x), so that the image can be shaded again with
+		// other colors. russian roulette is turned off, since other
+		// colors would end paths at other bounces. true if it was on
+		bool record();
+
+		// bytes 'record' allocates for the paths of the whole image
+		std::size_t recordBytes();
+
+		// shade a pixel from its recorded paths with the colors of
+		// the seed the renderer was created from. no ray is marched
+		math::vec3 shade(double y, double x);
+
+		// forget the sky light cached by earlier renders, so that a
+		// render doesn't reuse records taken at another resolution
+		// or sample count
+		void clearCache();
+
+		// shade every later render with another 'shading' mode
+		// than the config file's. used by exploration thumbnails,
+		// which only need to show the composition
+		void setShading(int shading);
+
+		// number of samples render(y, x) takes per pixel
+		int getSamples();
 };
@@ -0,0 +1,84 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#include "sampler.h"
+
+// reverse the bit order of a 32 bit integer
+static std::uint32_t reverse(std::uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// integer hash with good avalanche, by chris wellons
+static std::uint32_t hash(std::uint32_t x) {
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+// owen scramble. every bit is flipped depending on the bits above
+// it, which shuffles the strata of the sequence at every scale
+// while keeping them evenly filled
+static std::uint32_t scramble(std::uint32_t x, std::uint32_t seed) {
+	x = reverse(x);
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1;
+	x ^= x * 0x05526c56u;
+	x ^= x * 0x53a22864u;
+	return reverse(x);
+}
+
+sampler::sampler(seed* s, bool stratified, std::uint32_t pixel, std::uint32_t index) {
+	this->s = s;
+	this->stratified = stratified;
+	this->pixel = hash(pixel);
+	this->index = index;
+	this->dimension = 0;
+}
+
+double sampler::next() {
+	if (!stratified) {
+		return s->d(0.0, 1.0);
+	}
+	double a, b;
+	next(a, b);
+	return a;
+}
+
+void sampler::next(double& a, double& b) {
+	if (!stratified) {
+		a = s->d(0.0, 1.0);
+		b = s->d(0.0, 1.0);
+		return;
+	}
+
+	//
+	// every pair of dimensions shuffles the order of the samples
+	// with its own seed, so that pairs aren't correlated
+	//
+	std::uint32_t pairSeed = hash(pixel ^ hash(dimension++));
+	std::uint32_t i = scramble(index, pairSeed);
+
+	//
+	// first two dimensions of the sobol sequence
+	//
+	std::uint32_t x = reverse(i);
+	std::uint32_t y = 0;
+	for (std::uint32_t v = 1u << 31; i; i >>= 1, v ^= v >> 1) {
+		if (i & 1) {
+			y ^= v;
+		}
+	}
+
+	a = scramble(x, hash(pairSeed + 1)) * (1.0 / 4294967296.0);
+	b = scramble(y, hash(pairSeed + 2)) * (1.0 / 4294967296.0);
+}
@@ -0,0 +1,42 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#pragma once
+
+#include "seed.h"
+
+#include <cstdint>
+
+// random numbers of a single pixel sample. every call draws the
+// next dimension of the sample: its position inside the pixel,
+// then the numbers of every bounce in the order they're used.
+// stratified samplers take every dimension from an owen scrambled
+// sobol sequence, so the samples of a pixel spread evenly over
+// each dimension instead of clumping. the scramble is seeded by the
+// pixel, which turns the error of neighbouring pixels into high
+// frequency noise. explained in detail by brent burley:
+// https://jcgt.org/published/0009/04/01/
+// the rest draw independent numbers from the seed's rng
+class sampler {
+	private:
+		seed* s;
+		bool stratified;
+		std::uint32_t pixel;
+		std::uint32_t index;
+		std::uint32_t dimension;
+
+	public:
+		// sample 'index' of a pixel. 'pixel' can be any number
+		// that tells it apart from other pixels
+		sampler(seed* s, bool stratified, std::uint32_t pixel, std::uint32_t index);
+
+		// next number, in [0, 1)
+		double next();
+
+		// next pair of numbers, in [0, 1). stratified samplers
+		// spread them evenly over the square, not just each one on
+		// its own
+		void next(double& a, double& b);
+};
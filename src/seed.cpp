@@ -4,13 +4,23 @@
  */
 
 #include "seed.h"
+#include "fractal.h"
 
 #include <algorithm>
+#include <charconv>
 
 // mersennes' twister prng algo initialized with random device
 // seed
 
 seed::seed() : rng(dev()) {
+	randomize();
+}
+
+seed::seed(unsigned int value) : rng(value) {
+	randomize();
+}
+
+void seed::randomize() {
 
 	//                                                      //
 	//======== r e n d e r e r    c o n s t a n t s ========//
@@ -228,12 +238,24 @@ seed::seed(std::string s) {
 				case 30:
 					values["pointIterator"] = value;
 					break;
+				case 31:
+					values["formulaLength"] = value;
+					break;
+				default:
+					// formula operations, as pairs of code and parameter.
+					// codes past OP_SHIFT_Z aren't stored in seeds
+					if ((arg - 32) % 2 == 0 && (value != std::floor(value) || value < OP_ABSOLUTE || value > OP_SHIFT_Z)) {
+						seedParsingSuccessful = false;
+						return;
+					}
+					values["formula" + std::to_string((arg - 32) / 2) + ((arg - 32) % 2 ? "param" : "op")] = value;
+					break;
 			}
 			++arg;
 			str = "";
 		}
 	}
-	seedParsingSuccessful = arg == 31;
+	seedParsingSuccessful = arg == 31 || (arg >= 32 && arg == 32 + 2 * (int)values["formulaLength"]);
 }
 
 seed::~seed() {
@@ -244,73 +266,98 @@ std::string seed::buildSeed() {
 	std::vector<char> endOps = { '}', ')', '>', ']' };
 	std::vector<char> separationOps = { '!', '@', '#', '$', '%', '^', '&', '*' };
 	int n = startOps.size() - 1, m = separationOps.size() - 1;
+	// operators are only decoration. they're drawn from their own
+	// generator, so that storing a seed never changes the numbers
+	// its renders draw from 'rng'
+	std::minstd_rand decoration(dev());
+	auto i = [&](int min, int max) {
+		return std::uniform_int_distribution<int>(min, max)(decoration);
+	};
 	std::string s = "";
 	s += startOps[i(0, n)];
-	s += std::to_string(values["GLOSSINESS_CHANCE"]);
+	s += format(values["GLOSSINESS_CHANCE"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["GLOSSINESS_AMOUNT"]);
+	s += format(values["GLOSSINESS_AMOUNT"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xcameraDirection"]);
+	s += format(values["xcameraDirection"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["ycameraDirection"]);
+	s += format(values["ycameraDirection"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zcameraDirection"]);
+	s += format(values["zcameraDirection"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["cameraDistance"]);
+	s += format(values["cameraDistance"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xlightDirection"]);
+	s += format(values["xlightDirection"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["ylightDirection"]);
+	s += format(values["ylightDirection"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zlightDirection"]);
+	s += format(values["zlightDirection"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xlightColor"]);
+	s += format(values["xlightColor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["ylightColor"]);
+	s += format(values["ylightColor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zlightColor"]);
+	s += format(values["zlightColor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xskyColor"]);
+	s += format(values["xskyColor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["yskyColor"]);
+	s += format(values["yskyColor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zskyColor"]);
+	s += format(values["zskyColor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["iterations"]);
+	s += format(values["iterations"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["shadowSoftness"]);
+	s += format(values["shadowSoftness"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xcolor"]);
+	s += format(values["xcolor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["ycolor"]);
+	s += format(values["ycolor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zcolor"]);
+	s += format(values["zcolor"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xgradientTop"]);
+	s += format(values["xgradientTop"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["ygradientTop"]);
+	s += format(values["ygradientTop"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zgradientTop"]);
+	s += format(values["zgradientTop"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xgradientBottom"]);
+	s += format(values["xgradientBottom"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["ygradientBottom"]);
+	s += format(values["ygradientBottom"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zgradientBottom"]);
+	s += format(values["zgradientBottom"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xshift"]);
+	s += format(values["xshift"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zshift"]);
+	s += format(values["zshift"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["xrotation"]);
+	s += format(values["xrotation"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["zrotation"]);
+	s += format(values["zrotation"]);
 	s += separationOps[i(0, m)];
-	s += std::to_string(values["pointIterator"]);
+	s += format(values["pointIterator"]);
+	int length = values.count("formulaLength") ? (int)values["formulaLength"] : 0;
+	if (length > 0) {
+		s += separationOps[i(0, m)];
+		s += std::to_string(length);
+		for (int j = 0; j < length; ++j) {
+			std::string op = "formula" + std::to_string(j);
+			s += separationOps[i(0, m)];
+			s += std::to_string((int)values[op + "op"]);
+			s += separationOps[i(0, m)];
+			s += format(values[op + "param"]);
+		}
+	}
 	s += endOps[i(0, n)];
 	return s;
 }
 
+std::string seed::format(double value) {
+	char buffer[512];
+	auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::fixed);
+	return std::string(buffer, result.ptr);
+}
+
 int seed::i(int min, int max) {
 	std::uniform_int_distribution<int> dice(min, max);
 	return dice(rng);
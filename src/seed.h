@@ -17,13 +17,19 @@ class seed {
 		std::random_device dev;
 		std::mt19937 rng;
 		math::vec3 vec3(double min, double max);
+		// draw every value of the 'values' dictionary
+		void randomize();
 
 	public:
 		// used to catch any exceptions when parsing a user
 		// input seed
 		bool seedParsingSuccessful;
 
+		// random seed
 		seed();
+		// random seed drawn from a fixed rng state, so that the
+		// same value always gives the same seed and render
+		seed(unsigned int value);
 		// build 'values' dictionary from a user input seed.
 		// seed operators:
 		// ~start/end operators: { {, (, <, [ }
@@ -35,15 +41,28 @@ class seed {
 		// zskycol, iter, pointIterator, xcol, ycol, zcol, xgt,
 		// ygt, zgt, xgb, ygb, zgb, xshift, zshift,
 		// xrot, zrot, shadow_softness ]
+		// optionally followed by a custom formula, which then
+		// replaces the point iterator, shifts and rotations:
+		// [ ..., length, op, param, op, param, ... ]
+		// with the operation codes of fractal.h: 0 abs, 1 rotx,
+		// 2 roty, 3 rotz, 4 menger fold, 5 sierpinski fold,
+		// 6 shiftx, 7 shifty, 8 shiftz. params are angles in
+		// radians for rotations and amounts for shifts
 		seed(std::string s);
 		~seed();
 	
 		// dictionary for constants and their values
 		std::map<std::string, double> values;
 
-		// get the current seed based off the values dictionary
+		// get the current seed based off the values dictionary.
+		// doesn't draw from the seed's rng
 		std::string buildSeed();
 
+		// shortest decimal text of a value which parses back to
+		// exactly the same value. never uses exponents, so it's
+		// always a valid seed value
+		static std::string format(double value);
+
 		// get random integer in range between min and max
 		int i(int min, int max);
 
@@ -0,0 +1,665 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#include "server.h"
+#include "config.h"
+#include "fractal.h"
+#include "image.h"
+#include "renderer.h"
+#include "seed.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace server {
+	enum jobState {
+		QUEUED,
+		RENDERING,
+		DONE,
+		CANCELLED,
+		FAILED
+	};
+
+	static const char* stateNames[] = { "queued", "rendering", "done", "cancelled", "failed" };
+
+	// config variables a job can override
+	static const std::vector<std::string> settingNames = { "width", "height", "samples", "clamp", "sampler", "shading", "fov", "bounces", "roulette", "bounds", "lod", "budget", "irradiance" };
+
+	struct job {
+		std::string id;
+		std::string seed;
+		std::string output;
+		std::map<std::string, double> settings;
+		int priority;
+		long long order;
+		// guarded by the server lock
+		int state;
+		int height;
+		std::string error;
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point end;
+		double seconds;
+		// written by the pool while rendering
+		std::atomic<bool> cancelled;
+		std::atomic<int> rows;
+		std::atomic<long long> rays;
+		std::atomic<long long> evaluations;
+		job() : priority(0), order(0), state(QUEUED), height(0), seconds(0.0), cancelled(false), rows(0), rays(0), evaluations(0) {}
+	};
+
+	//
+	// server state. the lock guards the queue, the job states and
+	// the job handed to the pool
+	//
+	static std::mutex lock;
+	static std::condition_variable queued;
+	static std::condition_variable wake;
+	static std::condition_variable finished;
+	static std::vector<job*> jobs;
+	static std::vector<job*> queue;
+	static long long submitted = 0;
+	static bool closing = false;
+	static bool stopping = false;
+
+	// job being rendered by the pool
+	static job* current = nullptr;
+	static renderer* currentRenderer = nullptr;
+	static float* currentImage = nullptr;
+	static int currentWidth = 0;
+	static long long generation = 0;
+	static int busy = 0;
+	static std::atomic<int> nextRow(0);
+
+	// values of the overridable variables at the config file
+	static std::map<std::string, double> defaults;
+
+	// seconds a finished job can still be asked about before it's
+	// forgotten
+	static const double FINISHED_SECONDS = 60.0;
+
+	// largest image side and pixel count a job can ask for
+	static const double MAX_SIDE = 16384.0;
+	static const double MAX_PIXELS = 67108864.0;
+
+	// directory every job's output is stored at
+	static std::filesystem::path directory;
+
+	// output settings, read once
+	static int png;
+	static int hdr;
+	static double exposure;
+	static double gamma;
+
+	// the standard output is shared by every thread
+	static std::mutex outputLock;
+
+	static void send(const std::string& line) {
+		std::lock_guard<std::mutex> guard(outputLock);
+		std::cout << line << std::endl;
+	}
+
+	static std::string quote(const std::string& text) {
+		std::string res = "\"";
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				res += '\\';
+				res += c;
+			} else if (c == '\n') {
+				res += "\\n";
+			} else if ((unsigned char)c >= 0x20) {
+				res += c;
+			}
+		}
+		return res + "\"";
+	}
+
+	//
+	// parse a json string starting at its opening quote. escaped
+	// unicode characters outside of ascii become '?'
+	//
+	static bool parseString(const std::string& line, std::size_t& i, std::string& out) {
+		if (i >= line.size() || line[i] != '"') {
+			return false;
+		}
+		for (++i; i < line.size(); ++i) {
+			char c = line[i];
+			if (c == '"') {
+				++i;
+				return true;
+			}
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (++i >= line.size()) {
+				return false;
+			}
+			switch (line[i]) {
+				case 'n': out += '\n'; break;
+				case 't': out += '\t'; break;
+				case 'r': out += '\r'; break;
+				case 'b': out += '\b'; break;
+				case 'f': out += '\f'; break;
+				case 'u': {
+					if (i + 4 >= line.size()) {
+						return false;
+					}
+					for (std::size_t k = i + 1; k <= i + 4; ++k) {
+						if (!std::isxdigit((unsigned char)line[k])) {
+							return false;
+						}
+					}
+					int code = std::stoi(line.substr(i + 1, 4), nullptr, 16);
+					out += code < 0x80 ? (char)code : '?';
+					i += 4;
+					break;
+				}
+				default: out += line[i]; break;
+			}
+		}
+		return false;
+	}
+
+	//
+	// parse a flat json object into its keys and values. values are
+	// kept as text, strings without their quotes. nested objects
+	// and arrays aren't supported
+	//
+	static bool parse(const std::string& line, std::map<std::string, std::string>& fields) {
+		std::size_t i = 0;
+		auto skip = [&]() {
+			while (i < line.size() && std::isspace((unsigned char)line[i])) {
+				++i;
+			}
+		};
+		skip();
+		if (i >= line.size() || line[i++] != '{') {
+			return false;
+		}
+		skip();
+		if (i < line.size() && line[i] == '}') {
+			return true;
+		}
+		while (i < line.size()) {
+			std::string key, value;
+			skip();
+			if (!parseString(line, i, key)) {
+				return false;
+			}
+			skip();
+			if (i >= line.size() || line[i++] != ':') {
+				return false;
+			}
+			skip();
+			if (i < line.size() && line[i] == '"') {
+				if (!parseString(line, i, value)) {
+					return false;
+				}
+			} else {
+				while (i < line.size() && line[i] != ',' && line[i] != '}' && !std::isspace((unsigned char)line[i])) {
+					value += line[i++];
+				}
+				if (value.empty() || value[0] == '{' || value[0] == '[') {
+					return false;
+				}
+			}
+			fields[key] = value;
+			skip();
+			if (i < line.size() && line[i] == ',') {
+				++i;
+			} else if (i < line.size() && line[i] == '}') {
+				return true;
+			} else {
+				return false;
+			}
+		}
+		return false;
+	}
+
+	// json object describing a job. expects the server lock
+	static std::string describe(job* j, std::string event) {
+		std::ostringstream out;
+		out << "{\"event\":" << quote(event) << ",\"id\":" << quote(j->id) << ",\"state\":" << quote(stateNames[j->state]);
+		out << ",\"priority\":" << j->priority;
+		if (j->state == RENDERING) {
+			double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - j->start).count();
+			out << ",\"progress\":" << (j->height ? (double)j->rows / j->height : 0.0) << ",\"seconds\":" << seconds;
+		} else if (j->state != QUEUED) {
+			out << ",\"seconds\":" << j->seconds;
+		}
+		if (j->state == RENDERING || j->state == DONE) {
+			out << ",\"rays\":" << j->rays << ",\"evaluations\":" << j->evaluations;
+		}
+		if (j->state == DONE) {
+			out << ",\"output\":" << quote(j->output);
+		}
+		if (j->state == FAILED) {
+			out << ",\"error\":" << quote(j->error);
+		}
+		out << "}";
+		return out.str();
+	}
+
+	static void sendError(std::string message) {
+		send("{\"event\":\"error\",\"message\":" + quote(message) + "}");
+	}
+
+	//
+	// pool thread. renders rows of the current job until none are
+	// left or the job is cancelled, then waits for the next one
+	//
+	static void work() {
+		long long seen = 0;
+		for (;;) {
+			job* j;
+			renderer* r;
+			float* image;
+			int width;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				wake.wait(guard, [&] { return stopping || generation != seen; });
+				if (stopping) {
+					return;
+				}
+				seen = generation;
+				j = current;
+				r = currentRenderer;
+				image = currentImage;
+				width = currentWidth;
+			}
+			int height = j->height;
+			for (int y = nextRow.fetch_add(1); y < height && !j->cancelled; y = nextRow.fetch_add(1)) {
+				long long rays = fractal::rays;
+				long long evaluations = fractal::evaluations;
+				for (int x = 0; x < width; ++x) {
+					math::vec3 pixel = r->render((double)height - ((double)y + 0.5), (double)x + 0.5);
+					float* out = image + ((std::size_t)y * width + x) * 3;
+					out[0] = (float)pixel.x;
+					out[1] = (float)pixel.y;
+					out[2] = (float)pixel.z;
+				}
+				j->rays += fractal::rays - rays;
+				j->evaluations += fractal::evaluations - evaluations;
+				++j->rows;
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			if (--busy == 0) {
+				finished.notify_all();
+			}
+		}
+	}
+
+	// mark a job that couldn't be rendered as failed
+	static void fail(job* j, const std::string& error) {
+		std::lock_guard<std::mutex> guard(lock);
+		j->end = std::chrono::steady_clock::now();
+		j->seconds = std::chrono::duration<double>(j->end - j->start).count();
+		j->state = FAILED;
+		j->error = error;
+		send(describe(j, "failed"));
+	}
+
+	//
+	// render a job on the pool and store its seed and image
+	//
+	static void renderJob(job* j, int threadCount) {
+		// random seeds are parsed back from their stored form, so
+		// that the seed file renders the same image
+		seed* s = new seed(j->seed.empty() ? seed().buildSeed() : j->seed);
+		if (!j->seed.empty() && !s->seedParsingSuccessful) {
+			delete s;
+			fail(j, "seed not valid");
+			return;
+		}
+
+		//
+		// the pool is idle and nothing else reads the config, so
+		// the job's settings can be set for the renderer to read
+		//
+		for (auto& name : settingNames) {
+			config::set(name, j->settings.count(name) ? j->settings[name] : defaults[name]);
+		}
+		int width = std::max(1, config::getInt("width"));
+		int height = std::max(1, config::getInt("height"));
+
+		// sizes are checked on submission, but memory can still run
+		// out, which fails the job instead of the server
+		std::vector<float> image;
+		try {
+			image.resize((std::size_t)width * height * 3, 0.0f);
+		} catch (const std::bad_alloc&) {
+			delete s;
+			fail(j, "not enough memory for the image");
+			return;
+		}
+		fractal* f = new fractal(s);
+		renderer* r = new renderer(width, height, s, f);
+
+		auto start = std::chrono::steady_clock::now();
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			j->height = height;
+			current = j;
+			currentRenderer = r;
+			currentImage = image.data();
+			currentWidth = width;
+			nextRow = 0;
+			busy = threadCount;
+			++generation;
+			wake.notify_all();
+			finished.wait(guard, [] { return busy == 0; });
+			current = nullptr;
+		}
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		//
+		// store the seed next to the image, so that jobs drawing a
+		// random seed can be rendered again
+		//
+		std::string error;
+		if (!j->cancelled) {
+			std::string path = (directory / j->output).string();
+			std::ofstream seedOut(path + ".txt");
+			seedOut << s->buildSeed();
+			seedOut.close();
+			std::vector<std::uint8_t> ldr((std::size_t)width * height * 3);
+			image::tonemap(image.data(), ldr.data(), (std::size_t)width * height, exposure, gamma);
+			bool ok = png ? image::writePng(path + ".png", ldr.data(), width, height) : image::writePpm(path + ".ppm", ldr.data(), width, height);
+			if (ok && hdr == 1) {
+				ok = image::writePfm(path + ".pfm", image.data(), width, height);
+			} else if (ok && hdr == 2) {
+				ok = image::writeRaw(path + ".raw", image.data(), width, height);
+			}
+			if (!ok) {
+				error = "couldn't store '" + j->output + "'";
+			}
+		}
+		delete s;
+		delete f;
+		delete r;
+
+		std::lock_guard<std::mutex> guard(lock);
+		j->seconds = seconds;
+		j->end = std::chrono::steady_clock::now();
+		j->state = j->cancelled ? CANCELLED : error.empty() ? DONE : FAILED;
+		j->error = error;
+		send(describe(j, stateNames[j->state]));
+	}
+
+	//
+	// hand queued jobs to the pool, highest priority first and in
+	// arrival order within a priority, until the server closes and
+	// the queue is empty
+	//
+	static void dispatch(int threadCount) {
+		for (;;) {
+			job* j;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				queued.wait(guard, [] { return closing || !queue.empty(); });
+				if (queue.empty()) {
+					return;
+				}
+				auto best = std::min_element(queue.begin(), queue.end(), [](job* a, job* b) {
+					return a->priority != b->priority ? a->priority > b->priority : a->order < b->order;
+				});
+				j = *best;
+				queue.erase(best);
+				j->state = RENDERING;
+				j->start = std::chrono::steady_clock::now();
+				send(describe(j, "started"));
+			}
+			renderJob(j, threadCount);
+		}
+	}
+
+	static bool number(const std::string& text, double& value) {
+		try {
+			std::size_t used;
+			value = std::stod(text, &used);
+			return used == text.size();
+		} catch (...) {
+			return false;
+		}
+	}
+
+	//
+	// outputs are relative paths that stay inside the output
+	// directory, so a job can't write anywhere else
+	//
+	static bool confined(const std::string& output) {
+		std::filesystem::path path(output);
+		if (output.empty() || path.has_root_name() || path.has_root_directory()) {
+			return false;
+		}
+		for (auto& part : path) {
+			if (part == "..") {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// forget jobs that finished long enough ago. expects the server
+	// lock
+	static void evict() {
+		auto now = std::chrono::steady_clock::now();
+		jobs.erase(std::remove_if(jobs.begin(), jobs.end(), [&](job* j) {
+			bool old = (j->state == DONE || j->state == CANCELLED || j->state == FAILED) && std::chrono::duration<double>(now - j->end).count() > FINISHED_SECONDS;
+			if (old) {
+				delete j;
+			}
+			return old;
+		}), jobs.end());
+	}
+
+	//
+	// check the settings a job renders with, its own or the config
+	// file's, against the ranges idyll_create accepts. nan is out of
+	// every range. returns an empty string if they're valid
+	//
+	static std::string checkSettings(job* j) {
+		auto value = [&](const std::string& name) {
+			return j->settings.count(name) ? j->settings[name] : defaults[name];
+		};
+		double width = value("width");
+		double height = value("height");
+		if (!(width >= 1.0 && height >= 1.0 && width <= MAX_SIDE && height <= MAX_SIDE && width * height <= MAX_PIXELS)) {
+			return "image size out of range";
+		}
+		if (!(value("samples") >= 1.0)) {
+			return "'samples' must be at least one";
+		}
+		if (!(value("bounces") >= 1.0)) {
+			return "'bounces' must be at least one";
+		}
+		if (!(value("fov") > 0.0 && value("fov") < 180.0)) {
+			return "'fov' must be between 0 and 180";
+		}
+		return "";
+	}
+
+	// queue a render job from its json fields
+	static void submit(std::map<std::string, std::string>& fields) {
+		job* j = new job();
+		double value;
+		for (auto& field : fields) {
+			const std::string& key = field.first;
+			if (key == "cmd") {
+				continue;
+			} else if (key == "id") {
+				j->id = field.second;
+			} else if (key == "seed") {
+				j->seed = field.second;
+			} else if (key == "output") {
+				j->output = field.second;
+			} else if (key == "priority" && number(field.second, value)) {
+				j->priority = (int)value;
+			} else if (std::find(settingNames.begin(), settingNames.end(), key) != settingNames.end() && number(field.second, value)) {
+				j->settings[key] = value;
+			} else {
+				sendError("invalid field '" + key + "'");
+				delete j;
+				return;
+			}
+		}
+		std::string invalid = checkSettings(j);
+		if (!invalid.empty()) {
+			sendError(invalid);
+			delete j;
+			return;
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+		if (j->id.empty()) {
+			j->id = "job" + std::to_string(submitted);
+		}
+		for (auto& other : jobs) {
+			if (other->id == j->id) {
+				sendError("job '" + j->id + "' already exists");
+				delete j;
+				return;
+			}
+		}
+		if (j->output.empty()) {
+			j->output = "render-" + j->id;
+		}
+		if (!confined(j->output)) {
+			sendError("output '" + j->output + "' is outside the output directory");
+			delete j;
+			return;
+		}
+		j->order = submitted++;
+		jobs.push_back(j);
+		queue.push_back(j);
+		send(describe(j, "queued"));
+		queued.notify_all();
+	}
+
+	// cancel a job. queued jobs are cancelled right away, and
+	// running ones once the pool notices. finished jobs only
+	// report their state. expects the server lock
+	static void cancel(job* j) {
+		if (j->state == QUEUED) {
+			j->cancelled = true;
+			queue.erase(std::find(queue.begin(), queue.end(), j));
+			j->state = CANCELLED;
+			j->end = std::chrono::steady_clock::now();
+			send(describe(j, "cancelled"));
+		} else if (j->state == RENDERING) {
+			j->cancelled = true;
+		} else {
+			send(describe(j, "status"));
+		}
+	}
+
+	int run(int threadCount, std::string outputDirectory) {
+		threadCount = std::max(1, threadCount);
+		directory = outputDirectory;
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		for (auto& name : settingNames) {
+			defaults[name] = config::getDouble(name);
+		}
+		png = config::getInt("png");
+		hdr = config::getInt("hdr");
+		exposure = config::getDouble("exposure");
+		gamma = config::getDouble("gamma");
+
+		//
+		// warm pool. its threads live as long as the server, so jobs
+		// don't pay for creating them
+		//
+		std::vector<std::thread> pool;
+		for (int i = 0; i < threadCount; ++i) {
+			pool.push_back(std::thread{work});
+		}
+		std::thread dispatcher(dispatch, threadCount);
+		send("{\"event\":\"ready\",\"threads\":" + std::to_string(threadCount) + "}");
+
+		for (std::string line; std::getline(std::cin, line); ) {
+			if (line.find_first_not_of(" \t\r") == std::string::npos) {
+				continue;
+			}
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				evict();
+			}
+			std::map<std::string, std::string> fields;
+			if (!parse(line, fields)) {
+				sendError("invalid json object");
+				continue;
+			}
+			std::string cmd = fields["cmd"];
+			if (cmd == "render") {
+				submit(fields);
+			} else if (cmd == "cancel" || cmd == "status") {
+				std::lock_guard<std::mutex> guard(lock);
+				bool all = !fields.count("id");
+				bool found = false;
+				for (auto& j : jobs) {
+					if (all || j->id == fields["id"]) {
+						found = true;
+						if (cmd == "cancel") {
+							cancel(j);
+						} else {
+							send(describe(j, "status"));
+						}
+					}
+				}
+				if (!found && !all) {
+					sendError("job '" + fields["id"] + "' not found");
+				}
+			} else if (cmd == "quit") {
+				std::lock_guard<std::mutex> guard(lock);
+				for (auto& j : jobs) {
+					if (j->state == QUEUED || j->state == RENDERING) {
+						cancel(j);
+					}
+				}
+				break;
+			} else {
+				sendError("unknown command '" + cmd + "'");
+			}
+		}
+
+		//
+		// finish what's left in the queue, then stop the pool
+		//
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closing = true;
+			queued.notify_all();
+		}
+		dispatcher.join();
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+			wake.notify_all();
+		}
+		for (auto& thread : pool) {
+			thread.join();
+		}
+		for (auto& j : jobs) {
+			delete j;
+		}
+		send("{\"event\":\"closed\"}");
+		return 0;
+	}
+}
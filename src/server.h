@@ -0,0 +1,33 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#pragma once
+
+#include <string>
+
+namespace server {
+	// long running render server. reads one json object per line
+	// from the standard input and answers with one json object per
+	// line on the standard output:
+	// - {"cmd": "render", "id": "a", "seed": "...", "priority": 1,
+	//   "width": 640, "height": 480, "samples": 4, ...}
+	//   queues a render job. every field but "cmd" is optional.
+	//   a missing seed is drawn at random, and missing settings
+	//   come from the config file. the image is stored at
+	//   "output", "render-<id>" by default. jobs with settings out
+	//   of the ranges idyll_create accepts, or larger than 16384
+	//   pixels per side, are answered with an error event
+	// - {"cmd": "cancel", "id": "a"} cancels a queued or running job
+	// - {"cmd": "status", "id": "a"} reports a job, or every job
+	//   without an id
+	// - {"cmd": "quit"} cancels every job and exits
+	// jobs run one at a time, highest priority first, on a pool of
+	// 'threadCount' threads that lives as long as the server. their
+	// outputs are relative to 'directory', which they can't leave,
+	// and finished jobs are forgotten a minute after they end. at
+	// the end of the input every queued job is finished before
+	// exiting. returns the process exit code
+	extern int run(int threadCount, std::string directory);
+}
@@ -0,0 +1,97 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <vector>
+
+namespace trace {
+	bool enabled = false;
+
+	struct event {
+		const char* name;
+		long long id;
+		std::int64_t begin;
+		std::int64_t end;
+	};
+
+	// events of a single thread. only that thread appends to it,
+	// so recording doesn't lock anything
+	struct buffer {
+		int thread;
+		std::vector<event> events;
+	};
+
+	// every thread's buffer. they're kept after their threads end,
+	// until the trace is written
+	static std::mutex buffersMutex;
+	static std::vector<buffer*> buffers;
+	static thread_local buffer* local = nullptr;
+	static std::chrono::steady_clock::time_point origin;
+
+	// microseconds since tracing started
+	static std::int64_t now() {
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+	}
+
+	static buffer* threadBuffer() {
+		if (!local) {
+			local = new buffer();
+			std::lock_guard<std::mutex> lock(buffersMutex);
+			local->thread = (int)buffers.size();
+			buffers.push_back(local);
+		}
+		return local;
+	}
+
+	void start() {
+		origin = std::chrono::steady_clock::now();
+		enabled = true;
+		threadBuffer();
+	}
+
+	bool write(std::string path) {
+		std::ofstream file(path);
+		if (!file.good()) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		file << "{\"traceEvents\": [\n";
+		bool first = true;
+		for (auto b : buffers) {
+			file << (first ? "" : ",\n");
+			file << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << b->thread;
+			file << ", \"args\": {\"name\": \"" << (b->thread ? "thread " + std::to_string(b->thread) : "main") << "\"}}";
+			first = false;
+			for (auto& e : b->events) {
+				file << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << b->thread;
+				file << ", \"ts\": " << e.begin << ", \"dur\": " << e.end - e.begin;
+				if (e.id >= 0) {
+					file << ", \"args\": {\"id\": " << e.id << "}";
+				}
+				file << "}";
+			}
+		}
+		file << "\n]}\n";
+		return file.good();
+	}
+
+	scope::scope(const char* name, long long id) {
+		this->name = enabled ? name : nullptr;
+		if (this->name) {
+			this->id = id;
+			begin = now();
+		}
+	}
+
+	scope::~scope() {
+		if (name) {
+			threadBuffer()->events.push_back({ name, id, begin, now() });
+		}
+	}
+}
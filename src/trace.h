@@ -0,0 +1,41 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace trace {
+	// true while events are being recorded. it's only changed
+	// before any thread is started, so it's read without locking
+	extern bool enabled;
+
+	// start recording events. the calling thread is shown as the
+	// first one
+	extern void start();
+
+	// store every event recorded so far in the chrome trace event
+	// format, which can be opened at https://ui.perfetto.dev or
+	// chrome://tracing. returns false if the file couldn't be
+	// written
+	extern bool write(std::string path);
+
+	// records the time between its construction and destruction
+	// as an event of the calling thread. 'name' has to be a string
+	// literal. 'id' tells apart events of the same name, and
+	// negative ids aren't shown. costs a single branch when
+	// tracing is disabled
+	class scope {
+		private:
+			const char* name;
+			long long id;
+			std::int64_t begin;
+
+		public:
+			scope(const char* name, long long id = -1);
+			~scope();
+	};
+}
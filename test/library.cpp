@@ -0,0 +1,162 @@
+/*
+ * MIT License
+ * Copyright (c) 2020 Pablo Peñarroja
+ */
+
+//
+// host program for libidyll. renders through the public api only
+// and checks what src/idyll.h promises. built and run by 'make test'
+//
+
+#include "idyll.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+static void check(bool passed, const std::string& what) {
+	std::cout << (passed ? "[+] " : "[-] ") << what << '\n';
+	if (!passed) {
+		++failures;
+	}
+}
+
+// runs every task on its own batch of 'threads' threads
+static void parallelFor(void* context, int count, void (*task)(void* data, int i), void* data) {
+	int threads = *(int*)context;
+	std::vector<std::thread> workers;
+	for (int t = 0; t < threads; ++t) {
+		workers.emplace_back([=]() {
+			for (int i = t; i < count; i += threads) {
+				task(data, i);
+			}
+		});
+	}
+	for (std::thread& w : workers) {
+		w.join();
+	}
+}
+
+int main() {
+	const int W = 48;
+	const int H = 32;
+	idyll_settings settings;
+	idyll_default_settings(&settings);
+	settings.width = W;
+	settings.height = H;
+	settings.samples = 1;
+
+	idyll_renderer* r = idyll_create(nullptr, &settings);
+	check(r != nullptr, "renderer created from a random seed");
+	if (!r) {
+		return 1;
+	}
+
+	//
+	// the seed text renders the same image as the renderer it
+	// came from
+	//
+	std::vector<char> text(idyll_seed(r, nullptr, 0) + 1);
+	idyll_seed(r, text.data(), text.size());
+	idyll_renderer* copy = idyll_create(text.data(), &settings);
+	check(copy != nullptr, "renderer created from its seed text");
+
+	std::vector<float> full((size_t)W * H * 3);
+	check(idyll_render_float(r, 0, 0, W, H, full.data(), (size_t)W * 3, nullptr) == IDYLL_OK, "full image rendered on the calling thread");
+
+	if (copy) {
+		std::vector<float> again(full.size());
+		idyll_render_float(copy, 0, 0, W, H, again.data(), (size_t)W * 3, nullptr);
+		check(std::memcmp(full.data(), again.data(), full.size() * sizeof(float)) == 0, "seed text renders the same pixels");
+		idyll_destroy(copy);
+	}
+
+	//
+	// four regions on a pool of three threads give the pixels of
+	// the full render bit for bit
+	//
+	int threads = 3;
+	idyll_pool pool = { parallelFor, &threads };
+	std::vector<float> regions(full.size(), -1.0f);
+	int halfW = W / 2;
+	int halfH = H / 2;
+	bool ok = true;
+	for (int y = 0; y < H; y += halfH) {
+		for (int x = 0; x < W; x += halfW) {
+			ok &= idyll_render_float(r, x, y, halfW, halfH, regions.data() + ((size_t)y * W + x) * 3, (size_t)W * 3, &pool) == IDYLL_OK;
+		}
+	}
+	check(ok && std::memcmp(full.data(), regions.data(), full.size() * sizeof(float)) == 0, "regions rendered on a pool match the full render");
+
+	std::vector<uint8_t> bytes((size_t)W * H * 3);
+	check(idyll_render_rgb8(r, 0, 0, W, H, bytes.data(), (size_t)W * 3, 0.0, 2.2, &pool) == IDYLL_OK, "8-bit image rendered");
+
+	//
+	// invalid input is rejected
+	//
+	check(idyll_render_float(r, W / 2, 0, W, H, full.data(), (size_t)W * 3, nullptr) == IDYLL_INVALID, "region past the image rejected");
+	check(idyll_render_float(r, 0, 0, W, H, full.data(), (size_t)W, nullptr) == IDYLL_INVALID, "short stride rejected");
+	check(idyll_create("not a seed", &settings) == nullptr, "bad seed rejected");
+	std::string seedText(text.data());
+	std::string unknownOperation = seedText.substr(0, seedText.size() - 1) + "!1!9!0.5]";
+	check(idyll_create(unknownOperation.c_str(), &settings) == nullptr, "unknown formula operation rejected");
+	idyll_settings bad = settings;
+	bad.fov = 180;
+	check(idyll_create(nullptr, &bad) == nullptr, "bad settings rejected");
+
+	//
+	// unstratified samplers share the seed's rng, so they refuse
+	// pools but still render on the calling thread
+	//
+	idyll_settings shared = settings;
+	shared.sampler = 0;
+	idyll_renderer* unstratified = idyll_create(text.data(), &shared);
+	check(unstratified != nullptr, "renderer created with sampler 0");
+	if (unstratified) {
+		check(idyll_render_float(unstratified, 0, 0, W, H, full.data(), (size_t)W * 3, &pool) == IDYLL_INVALID, "sampler 0 rejects a pool");
+		check(idyll_render_float(unstratified, 0, 0, W, H, full.data(), (size_t)W * 3, nullptr) == IDYLL_OK, "sampler 0 renders on the calling thread");
+		idyll_destroy(unstratified);
+	}
+
+	//
+	// cancel stops a render in progress, and later renders aren't
+	// affected
+	//
+	idyll_settings large = settings;
+	large.width = 640;
+	large.height = 480;
+	large.samples = 16;
+	idyll_renderer* slow = idyll_create(text.data(), &large);
+	if (slow) {
+		std::vector<float> pixels((size_t)large.width * large.height * 3);
+		int result = IDYLL_OK;
+		auto start = std::chrono::steady_clock::now();
+		std::thread render([&]() {
+			result = idyll_render_float(slow, 0, 0, large.width, large.height, pixels.data(), (size_t)large.width * 3, nullptr);
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		idyll_cancel(slow);
+		render.join();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		check(result == IDYLL_CANCELLED && seconds < 5.0, "cancel stops a render in progress");
+		check(idyll_render_float(slow, 0, 0, 1, 1, pixels.data(), 3, nullptr) == IDYLL_OK, "renders after a cancel aren't cancelled");
+		idyll_destroy(slow);
+	}
+
+	idyll_destroy(r);
+
+	std::FILE* file = std::fopen("config.txt", "r");
+	check(file == nullptr, "no config.txt file created");
+	if (file) {
+		std::fclose(file);
+	}
+
+	std::cout << (failures ? "[-] " : "[+] ") << failures << " checks failed.\n";
+	return failures ? 1 : 0;
+}